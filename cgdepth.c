@@ -0,0 +1,296 @@
+/* cgdepth.c
+**
+** Measurement mode 'cgdepth': overhead of memory cgroup charging
+** related to the nesting depth of the cgroup
+**
+** Usage: usemem -x cgdepth [-o options] [-m|-s|-S] [flags]
+**                                     virtsize [physsize [alivesize]]
+**
+**   For every nesting depth, a chain of cgroups (version 2) is created
+**   below the parent cgroup and a child process moves itself into the
+**   deepest cgroup.  The child allocates virtsize, populates physsize,
+**   references alivesize a number of rounds, reads memory.stat of its
+**   cgroup repeatedly and releases the memory again.
+**
+** Options (-o):
+**   cgroup=path	parent cgroup directory (delegated subtree) in which
+**		usemem may create cgroups and enable the memory controller
+**		(default: the cgroup of usemem itself, which only works
+**		for the root cgroup)
+**   depths=list	colon-separated nesting depths (default 1:4:8:16)
+**   runs=n	number of runs per depth to be averaged (default 3)
+**   rounds=n	number of rounds to reference alivesize (default 5)
+**   statreads=n	number of reads of memory.stat (default 100)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "usemem.h"
+
+struct cgresult {
+	double		populate;	// seconds
+	long		faults;		// minor faults during populate
+	double		keepalive;	// seconds per round
+	double		release;	// seconds
+	double		statavg;	// seconds per read of memory.stat
+	double		statp99;
+};
+
+static int		cgchain(char *, int, char *, size_t);
+static void		cgremove(char *, int);
+static void		cgworkload(struct uconf *, char *, int, int, int);
+
+int
+cgdepthmode(struct uconf *cf)
+{
+	char		parent[PATH_MAX], deepest[PATH_MAX], *depths, *d;
+	int		depth, runs, rounds, statreads, r, pfd[2];
+	pid_t		pid;
+	struct cgresult	res, sum;
+
+	depths    = strdup(modeopt(cf, "depths") ? modeopt(cf, "depths") :
+	                                           "1:4:8:16");
+	runs      = modeoptnum(cf, "runs",      3);
+	rounds    = modeoptnum(cf, "rounds",    5);
+	statreads = modeoptnum(cf, "statreads", 100);
+
+	if (modeopt(cf, "cgroup")) {
+		snprintf(parent, sizeof parent, "%s", modeopt(cf, "cgroup"));
+	} else if (cgroupfile(parent, sizeof parent, "") == -1) {
+		fprintf(stderr, "no cgroup version 2 hierarchy mounted\n");
+		return 1;
+	}
+
+	if (parent[strlen(parent)-1] == '/')
+		parent[strlen(parent)-1] = 0;
+
+	if (runs <= 0 || rounds < 0 || statreads <= 0) {
+		fprintf(stderr, "invalid options for cgdepth mode\n");
+		return 1;
+	}
+
+	if (cf->alloctype == 'a') {
+		fprintf(stderr, "warning: malloc can not be released, "
+		                "mmap used instead\n");
+		cf->alloctype = 'm';
+	}
+
+	printf("%5s %12s %12s %12s %12s %12s %12s\n", "depth",
+	       "populate", "faults/s", "alive/round", "release",
+	       "stat avg", "stat p99");
+	fflush(stdout);		// no duplicate output by children
+
+	for (d = depths; *d; d += strcspn(d, ":"), d += *d == ':') {
+		if ( (depth = atoi(d)) <= 0) {
+			fprintf(stderr, "wrong depth: %.*s\n",
+			                (int)strcspn(d, ":"), d);
+			return 1;
+		}
+
+		memset(&sum, 0, sizeof sum);
+
+		for (r=0; r < runs; r++) {
+			if (cgchain(parent, depth, deepest, sizeof deepest) == -1) {
+				cgremove(parent, depth);
+				return 1;
+			}
+
+			if (pipe(pfd) == -1) {
+				perror("pipe");
+				return 1;
+			}
+
+			switch (pid = fork()) {
+			   case -1:
+				perror("fork");
+				return 1;
+
+			   case 0:
+				close(pfd[0]);
+				cgworkload(cf, deepest, pfd[1], rounds, statreads);
+				exit(0);
+			}
+
+			close(pfd[1]);
+
+			if (read(pfd[0], &res, sizeof res) != sizeof res) {
+				fprintf(stderr, "workload in cgroup at depth %d "
+				                "failed\n", depth);
+				waitpid(pid, NULL, 0);
+				cgremove(parent, depth);
+				return 1;
+			}
+
+			close(pfd[0]);
+			waitpid(pid, NULL, 0);
+			cgremove(parent, depth);
+
+			sum.populate  += res.populate;
+			sum.faults    += res.faults;
+			sum.keepalive += res.keepalive;
+			sum.release   += res.release;
+			sum.statavg   += res.statavg;
+			sum.statp99   += res.statp99;
+		}
+
+		printf("%5d %10.1fms %12.0f %10.2fms %10.2fms %10.1fus %10.1fus\n",
+		       depth, sum.populate * 1e3 / runs,
+		       sum.populate > 0 ? sum.faults / sum.populate : 0.0,
+		       sum.keepalive * 1e3 / runs, sum.release * 1e3 / runs,
+		       sum.statavg * 1e6 / runs, sum.statp99 * 1e6 / runs);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+/*
+** create a chain of nested cgroups below the parent with the memory
+** controller enabled, and return the path of the deepest one
+*/
+static int cgchain(char *parent, int depth, char *deepest, size_t len)
+{
+	char	path[PATH_MAX], name[32];
+	int	i;
+
+	snprintf(path, sizeof path, "%s", parent);
+
+	for (i=1; i <= depth; i++) {
+		if (i == 1)
+			snprintf(name, sizeof name, "usemem.%d", getpid());
+		else
+			snprintf(name, sizeof name, "%d", i);
+
+		if (cgcreate(path, name, deepest, len) == -1)
+			return -1;
+
+		snprintf(path, sizeof path, "%s", deepest);
+	}
+
+	return 0;
+}
+
+/*
+** remove the chain of nested cgroups bottom-up
+*/
+static void cgremove(char *parent, int depth)
+{
+	char	path[PATH_MAX];
+	int	i, n;
+
+	for (; depth > 0; depth--) {
+		n = snprintf(path, sizeof path, "%s/usemem.%d", parent, getpid());
+
+		for (i=2; i <= depth; i++)
+			n += snprintf(path+n, sizeof path - n, "/%d", i);
+
+		(void) rmdir(path);
+	}
+}
+
+/*
+** child: move into the cgroup, run the workload and
+** write the results to the pipe
+*/
+static void cgworkload(struct uconf *cf, char *cgroup, int fd,
+                       int rounds, int statreads)
+{
+	struct cgresult		res;
+	struct rusage		ru0, ru1;
+	unsigned long long	t, *lat;
+	char			path[PATH_MAX+32], *p, *msg, buf[16384];
+	int			i, statfd;
+
+	memset(&res, 0, sizeof res);
+
+	snprintf(path, sizeof path, "%s/cgroup.procs", cgroup);
+
+	if (writefile(path, "%d", getpid()) == -1) {
+		perror(path);
+		exit(1);
+	}
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		exit(1);
+	}
+
+	preadvise(cf, p, cf->virtual);
+
+	// populate
+	//
+	getrusage(RUSAGE_SELF, &ru0);
+	t = nanotime();
+
+	memset(p, 'X', cf->physical);
+
+	res.populate = (nanotime() - t) / 1e9;
+	getrusage(RUSAGE_SELF, &ru1);
+	res.faults   = ru1.ru_minflt - ru0.ru_minflt;
+
+	postadvise(cf, p, cf->virtual);
+
+	// keepalive
+	//
+	if (rounds && cf->keepalive) {
+		t = nanotime();
+
+		for (i=0; i < rounds; i++)
+			memset(p, 'X', cf->keepalive);
+
+		res.keepalive = (nanotime() - t) / 1e9 / rounds;
+	}
+
+	// read memory.stat of the own cgroup
+	//
+	snprintf(path, sizeof path, "%s/memory.stat", cgroup);
+
+	if ( (statfd = open(path, O_RDONLY)) == -1) {
+		perror(path);
+		exit(1);
+	}
+
+	if ( (lat = malloc(statreads * sizeof *lat)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i=0; i < statreads; i++) {
+		t = nanotime();
+
+		if (pread(statfd, buf, sizeof buf, 0) == -1) {
+			perror(path);
+			exit(1);
+		}
+
+		lat[i]       = nanotime() - t;
+		res.statavg += lat[i] / 1e9;
+	}
+
+	latsort(lat, statreads);
+	res.statavg /= statreads;
+	res.statp99  = latpct(lat, statreads, 99) / 1e9;
+
+	// release
+	//
+	t = nanotime();
+	freemem(cf, p, cf->virtual);
+	res.release = (nanotime() - t) / 1e9;
+
+	if (write(fd, &res, sizeof res) != sizeof res)
+		exit(1);
+}
@@ -0,0 +1,412 @@
+/* clients.c
+**
+** Measurement mode 'clients': thousands of independent clients, each
+** with its own small working set, think time and access pattern,
+** multiplexed as coroutines (ucontext) on a few threads
+**
+** Usage: usemem -x clients [-o options] [-m|-s|-S] [flags] virtsize
+**
+**   The area of virtsize is divided into one working set per client.
+**   Every client repeatedly thinks (an exponentially distributed time
+**   around the mean think time) and then handles a request by touching
+**   a piece of its working set according to its access pattern:
+**	seq	pieces in sequential order (wrapping around)
+**	random	pieces in random order
+**	hot	90% of the requests to the first 10% of the working set
+**   The service time of every request is kept per client.  At the end
+**   the distribution over the clients of their own p50 and p99 service
+**   time and of their resident working set is shown per pattern, with
+**   the worst clients, to expose unfairness of reclaim among clients.
+**
+** Options (-o):
+**   clients=n	number of clients (default 1000)
+**   threads=n	number of threads (default: number of CPUs)
+**   think=ms	mean think time per client (default 10)
+**   req=sz	bytes touched per request (default 4K)
+**   pattern=list	colon-separated patterns assigned round-robin to the
+**		clients (default seq:random:hot)
+**   duration=sec	duration of the run (default 30)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ucontext.h>
+
+#include "usemem.h"
+
+#define	STACKSIZE	(32*1024)	// coroutine stack per client
+#define	MAXLAT		128		// last service times kept per client
+#define	NPATTERNS	3
+#define	NWORST		5
+
+enum { P_SEQ, P_RANDOM, P_HOT };
+
+static char *patterns[NPATTERNS] = { "seq", "random", "hot" };
+
+struct client {
+	ucontext_t		ctx;
+	ucontext_t		*sched;		// context of the own thread
+	char			*ws;		// working set
+	int			pattern;
+	unsigned long long	wake;		// due time of next request
+	unsigned long long	rnd;		// random state
+	long long		next;		// next piece (seq)
+	long long		requests;
+	unsigned long long	delay;		// total scheduling delay
+	unsigned long long	lat[MAXLAT];
+	double			p50, p99, resident;
+};
+
+struct worker {
+	pthread_t		tid;
+	ucontext_t		sched;
+	struct client		**heap;		// clients ordered by wake time
+	int			n;
+};
+
+static struct client	*clients;
+static long long	wssize, reqsize, pieces;
+static double		think;		// mean think time in ns
+static volatile int	stop;
+
+static void		*worker(void *);
+static void		clientloop(int);
+static void		heapdown(struct worker *, int);
+static double		exprand(unsigned long long *);
+static int		dblcmp(const void *, const void *);
+static void		clientreport(int);
+
+int
+clientsmode(struct uconf *cf)
+{
+	char			*list, *s, *p, *msg, item[16];
+	int			nclients, nthreads, duration, i, n, pat[NPATTERNS],
+				npat;
+	struct worker		*w;
+	unsigned long long	start;
+
+	nclients = modeoptnum(cf, "clients",  1000);
+	nthreads = modeoptnum(cf, "threads",  sysconf(_SC_NPROCESSORS_ONLN));
+	think    = modeoptnum(cf, "think",    10) * 1e6;
+	reqsize  = modeoptnum(cf, "req",      4096);
+	duration = modeoptnum(cf, "duration", 30);
+	list     = strdup(modeopt(cf, "pattern") ? modeopt(cf, "pattern") :
+	                                           "seq:random:hot");
+
+	for (npat=0, s = list; *s; s += strcspn(s, ":"), s += *s == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(s, ":"), s);
+
+		for (i=0; i < NPATTERNS; i++)
+			if (strcmp(item, patterns[i]) == 0)
+				break;
+
+		if (i == NPATTERNS || npat == NPATTERNS) {
+			fprintf(stderr, "wrong pattern: %s\n", item);
+			return 1;
+		}
+
+		pat[npat++] = i;
+	}
+
+	wssize = cf->virtual / (nclients > 0 ? nclients : 1);
+	wssize = wssize / cf->pagesize * cf->pagesize;
+
+	if (nclients <= 0 || nthreads <= 0 || think < 0 || reqsize <= 0 ||
+	    reqsize > wssize || duration <= 0 || npat == 0) {
+		fprintf(stderr, "invalid options for clients mode "
+		                "(or virtsize too small)\n");
+		return 1;
+	}
+
+	pieces = wssize / reqsize;
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	preadvise(cf, p, cf->virtual);
+	memset(p, 'X', wssize * nclients);
+	postadvise(cf, p, cf->virtual);
+
+	// create the clients with their coroutine context and
+	// divide them over the threads
+	//
+	if ( (clients = calloc(nclients, sizeof *clients)) == NULL ||
+	     (w = calloc(nthreads, sizeof *w)) == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	for (i=0; i < nthreads; i++) {
+		if ( (w[i].heap = calloc(nclients / nthreads + 1,
+		                         sizeof *w[i].heap)) == NULL) {
+			perror("calloc");
+			return 1;
+		}
+	}
+
+	start = nanotime();
+
+	for (i=0; i < nclients; i++) {
+		struct client	*c = &clients[i];
+		struct worker	*cw = &w[i % nthreads];
+
+		c->ws      = p + i * wssize;
+		c->pattern = pat[i % npat];
+		c->rnd     = i * 2654435761ULL + 1;
+		c->sched   = &cw->sched;
+		c->wake    = start + exprand(&c->rnd) * think;
+
+		if (getcontext(&c->ctx) == -1 ||
+		    (c->ctx.uc_stack.ss_sp = malloc(STACKSIZE)) == NULL) {
+			perror("coroutine");
+			return 1;
+		}
+
+		c->ctx.uc_stack.ss_size = STACKSIZE;
+		c->ctx.uc_link          = &cw->sched;
+		makecontext(&c->ctx, (void (*)(void))clientloop, 1, i);
+
+		cw->heap[cw->n++] = c;
+	}
+
+	printf("%d clients on %d threads, working set %lld KiB per client "
+	       "(%s), request %lld KiB, think %.1f ms\n", nclients, nthreads,
+	       wssize/1024, msg, reqsize/1024, think / 1e6);
+	fflush(stdout);
+
+	for (i=0; i < nthreads; i++) {
+		for (n = w[i].n / 2 - 1; n >= 0; n--)
+			heapdown(&w[i], n);
+
+		if ( (errno = pthread_create(&w[i].tid, NULL, worker, &w[i])) ) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	sleep(duration);
+	stop = 1;
+
+	for (i=0; i < nthreads; i++)
+		pthread_join(w[i].tid, NULL);
+
+	clientreport(nclients);
+
+	return 0;
+}
+
+/*
+** thread: resume the client that is due first, until stopped
+*/
+static void *worker(void *arg)
+{
+	struct worker		*w = arg;
+	struct client		*c;
+	unsigned long long	now;
+	struct timespec		ts;
+
+	while (!stop && w->n) {
+		c   = w->heap[0];
+		now = nanotime();
+
+		if (c->wake > now) {
+			ts.tv_sec  = (c->wake - now) / 1000000000;
+			ts.tv_nsec = (c->wake - now) % 1000000000;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		swapcontext(&w->sched, &c->ctx);	// handle one request
+		heapdown(w, 0);				// new wake time
+	}
+
+	return NULL;
+}
+
+/*
+** coroutine of a client: handle a request and yield
+*/
+static void clientloop(int idx)
+{
+	struct client		*c = &clients[idx];
+	unsigned long long	t;
+	long long		piece;
+
+	for (;;) {
+		switch (c->pattern) {
+		   case P_SEQ:
+			piece = c->next++ % pieces;
+			break;
+
+		   case P_RANDOM:
+			c->rnd = c->rnd * 6364136223846793005ULL + 1;
+			piece  = (c->rnd >> 17) % pieces;
+			break;
+
+		   default:	// P_HOT
+			c->rnd = c->rnd * 6364136223846793005ULL + 1;
+
+			if ((c->rnd >> 33) % 10 && pieces >= 10)
+				piece = (c->rnd >> 17) % (pieces / 10);
+			else
+				piece = (c->rnd >> 17) % pieces;
+		}
+
+		t = nanotime();
+		c->delay += t - c->wake;
+		memset(c->ws + piece * reqsize, 'Y', reqsize);
+		c->lat[c->requests++ % MAXLAT] = nanotime() - t;
+
+		c->wake = nanotime() + exprand(&c->rnd) * think;
+
+		swapcontext(&c->ctx, c->sched);
+	}
+}
+
+/*
+** restore the heap order from position i downwards
+*/
+static void heapdown(struct worker *w, int i)
+{
+	struct client	*tmp;
+	int		child;
+
+	while ( (child = 2 * i + 1) < w->n) {
+		if (child + 1 < w->n &&
+		    w->heap[child+1]->wake < w->heap[child]->wake)
+			child++;
+
+		if (w->heap[i]->wake <= w->heap[child]->wake)
+			break;
+
+		tmp            = w->heap[i];
+		w->heap[i]     = w->heap[child];
+		w->heap[child] = tmp;
+		i              = child;
+	}
+}
+
+/*
+** exponentially distributed random number with mean 1
+*/
+static double exprand(unsigned long long *rnd)
+{
+	*rnd = *rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+
+	return -log(((*rnd >> 11) + 1.0) / 9007199254740993.0);
+}
+
+static int dblcmp(const void *a, const void *b)
+{
+	double	x = *(double *)a, y = *(double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+** distribution over the clients per pattern, and the worst clients
+*/
+static void clientreport(int nclients)
+{
+	unsigned long long	lat[MAXLAT], delay = 0;
+	double			*p50s, *p99s, *res;
+	long long		requests = 0;
+	int			i, j, n, pat, worst[NWORST];
+	struct pagestat		ps;
+
+	if ( (p50s = malloc(3 * nclients * sizeof *p50s)) == NULL)
+		return;
+
+	p99s = p50s + nclients;
+	res  = p99s + nclients;
+
+	for (i=0; i < nclients; i++) {
+		struct client	*c = &clients[i];
+
+		n = c->requests < MAXLAT ? c->requests : MAXLAT;
+		memcpy(lat, c->lat, n * sizeof *lat);
+		latsort(lat, n);
+
+		c->p50      = latpct(lat, n, 50) / 1e3;
+		c->p99      = latpct(lat, n, 99) / 1e3;
+		c->resident = pagestat(c->ws, wssize, STATPAGES / nclients,
+		                       &ps) == 0 ? ps.present * 100.0 / wssize : 0;
+
+		requests += c->requests;
+		delay    += c->delay;
+	}
+
+	printf("%lld requests, mean scheduling delay %.1f us\n", requests,
+	       requests ? delay / 1e3 / requests : 0);
+	printf("%-7s %7s %28s %28s %22s\n", "", "",
+	       "client p50 us", "client p99 us", "resident %");
+	printf("%-7s %7s %9s %9s %9s %9s %9s %9s %7s %7s %7s\n", "pattern",
+	       "clients", "min", "median", "max", "min", "median", "max",
+	       "min", "median", "max");
+
+	for (pat=0; pat < NPATTERNS; pat++) {
+		for (i=0, n=0; i < nclients; i++) {
+			if (clients[i].pattern != pat)
+				continue;
+
+			p50s[n] = clients[i].p50;
+			p99s[n] = clients[i].p99;
+			res[n]  = clients[i].resident;
+			n++;
+		}
+
+		if (!n)
+			continue;
+
+		qsort(p50s, n, sizeof *p50s, dblcmp);
+		qsort(p99s, n, sizeof *p99s, dblcmp);
+		qsort(res,  n, sizeof *res,  dblcmp);
+
+		printf("%-7s %7d %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f "
+		       "%7.1f %7.1f %7.1f\n", patterns[pat], n,
+		       p50s[0], p50s[n/2], p50s[n-1], p99s[0], p99s[n/2],
+		       p99s[n-1], res[0], res[n/2], res[n-1]);
+	}
+
+	// worst clients by their p99 service time
+	//
+	for (j=0; j < NWORST; j++)
+		worst[j] = -1;
+
+	for (i=0; i < nclients; i++) {
+		for (j=0; j < NWORST; j++) {
+			if (worst[j] == -1 || clients[i].p99 > clients[worst[j]].p99) {
+				memmove(&worst[j+1], &worst[j],
+				        (NWORST - j - 1) * sizeof *worst);
+				worst[j] = i;
+				break;
+			}
+		}
+	}
+
+	printf("worst clients:");
+
+	for (j=0; j < NWORST && worst[j] != -1; j++)
+		printf(" #%d (%s, p99 %.1f us, %.0f%% resident)", worst[j],
+		       patterns[clients[worst[j]].pattern],
+		       clients[worst[j]].p99, clients[worst[j]].resident);
+
+	printf("\n");
+	fflush(stdout);
+	free(p50s);
+}
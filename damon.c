@@ -0,0 +1,456 @@
+/* damon.c
+**
+** Measurement mode 'damon': validate the generated access pattern by
+** monitoring the memory area of usemem itself with DAMON (via sysfs)
+**
+** Usage: usemem -x damon [-o options] [-m|-s|-S] [flags]
+**                                     virtsize [physsize [alivesize]]
+**
+**   The memory area is allocated and referenced as usual.  The intended
+**   access pattern is:
+**	- alivesize	hot: touched every 'hotdelay' msec
+**	- rest of physsize	cold: touched once
+**	- rest of virtsize	untouched
+**
+** Options (-o):
+**   sample=us	DAMON sampling interval (default 5000)
+**   aggr=us	DAMON aggregation interval (default 100000)
+**   update=us	DAMON update interval (default 1000000)
+**   minregions=n	minimum number of DAMON regions (default 10)
+**   maxregions=n	maximum number of DAMON regions (default 1000)
+**   hotdelay=ms	delay between touches of the hot part (default 10)
+**   interval=sec	report interval in seconds (default 10)
+**   count=n	number of reports (default 0: until interrupted)
+**
+** DAMON is configured with kdamond 0 and the operations 'fvaddr'
+** (limited to the memory area) or otherwise 'vaddr'.  A scheme with
+** action 'stat' is used to retrieve the monitored regions.  This
+** requires that no other kdamond is running.  DAMON is switched off
+** again when usemem terminates (by count or by SIGINT/SIGTERM).
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "usemem.h"
+
+#define	KDAMONDS	"/sys/kernel/mm/damon/admin/kdamonds"
+#define	CONTEXT		KDAMONDS "/0/contexts/0"
+#define	SCHEME		CONTEXT "/schemes/0"
+
+static char		*hotarea;
+static long long	hotsize;
+static long		hotdelay;
+
+static volatile sig_atomic_t	stop;
+
+static int		damonsetup(char *, long long, long, long, long,
+			           long, long);
+static void		damonreport(char *, struct uconf *, long, long);
+static void		damonoff(void);
+static long long	damonvalue(const char *, int);
+static long long	cputicks(void);
+static void		*hotthread(void *);
+static void		catchstop(int);
+
+int
+damonmode(struct uconf *cf)
+{
+	pthread_t		tid;
+	char			*p, *msg;
+	long			sample, aggr, update, minreg, maxreg;
+	int			interval, count, n;
+	long long		ticks0, ticks;
+	unsigned long long	time0, now;
+
+	sample   = modeoptnum(cf, "sample",     5000);
+	aggr     = modeoptnum(cf, "aggr",       100000);
+	update   = modeoptnum(cf, "update",     1000000);
+	minreg   = modeoptnum(cf, "minregions", 10);
+	maxreg   = modeoptnum(cf, "maxregions", 1000);
+	hotdelay = modeoptnum(cf, "hotdelay",   10);
+	interval = modeoptnum(cf, "interval",   10);
+	count    = modeoptnum(cf, "count",      0);
+
+	if (sample <= 0 || aggr < sample || update < aggr ||
+	    minreg < 3 || maxreg < minreg || hotdelay < 0 || interval <= 0) {
+		fprintf(stderr, "invalid options for damon mode\n");
+		return 1;
+	}
+
+	// allocate and reference memory as usual
+	//
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	preadvise(cf, p, cf->virtual);
+
+	if (cf->physical)
+		memset(p, 'X', cf->physical);
+
+	postadvise(cf, p, cf->virtual);
+
+	printf("%lld KiB allocated (%s) at address %p: %lld KiB hot / "
+	       "%lld KiB cold / %lld KiB untouched\n",
+	       cf->virtual/1024, msg, p, cf->keepalive/1024,
+	       (cf->physical - cf->keepalive)/1024,
+	       (cf->virtual - cf->physical)/1024);
+
+	// keep the hot part referenced by a separate thread
+	//
+	if (cf->keepalive) {
+		hotarea = p;
+		hotsize = cf->keepalive;
+
+		if ( (errno = pthread_create(&tid, NULL, hotthread, NULL)) ) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	// configure and start DAMON
+	//
+	if (damonsetup(p, cf->virtual, sample, aggr, update, minreg, maxreg))
+		return 1;
+
+	atexit(damonoff);
+	signal(SIGINT,  catchstop);
+	signal(SIGTERM, catchstop);
+
+	ticks0 = cputicks();
+	time0  = nanotime();
+
+	printf("DAMON monitoring started (sample %ld us, aggr %ld us)\n",
+	       sample, aggr);
+	fflush(stdout);
+
+	for (n=0; !stop && (!count || n < count); n++) {
+		sleep(interval);
+
+		if (stop)
+			break;
+
+		damonreport(p, cf, sample, aggr);
+
+		ticks = cputicks();
+		now   = nanotime();
+
+		printf("kdamond CPU: %.2f%%\n\n", ticks0 < 0 || ticks < 0 ? 0.0 :
+		       (ticks - ticks0) * 100.0 / sysconf(_SC_CLK_TCK) /
+		       ((now - time0) / 1e9));
+		fflush(stdout);
+
+		ticks0 = ticks;
+		time0  = now;
+	}
+
+	return 0;
+}
+
+/*
+** configure kdamond 0 to monitor the memory area of this process
+** and switch it on
+*/
+static int damonsetup(char *p, long long size, long sample, long aggr,
+                      long update, long minreg, long maxreg)
+{
+	char	buf[256], path[128], *ops;
+	int	i, nr;
+
+	if (readfile(KDAMONDS "/nr_kdamonds", buf, sizeof buf) == -1) {
+		perror("DAMON sysfs interface " KDAMONDS);
+		return 1;
+	}
+
+	// verify that no other kdamond is active
+	//
+	nr = atoi(buf);
+
+	for (i=0; i < nr; i++) {
+		snprintf(path, sizeof path, KDAMONDS "/%d/state", i);
+
+		if (readfile(path, buf, sizeof buf) == 0 && strcmp(buf, "on") == 0) {
+			fprintf(stderr, "DAMON kdamond %d is already in use\n", i);
+			return 1;
+		}
+	}
+
+	if (writefile(KDAMONDS "/nr_kdamonds", "1") == -1 ||
+	    writefile(KDAMONDS "/0/contexts/nr_contexts", "1") == -1) {
+		perror("DAMON setup kdamond");
+		return 1;
+	}
+
+	// prefer the fixed virtual address space operations to
+	// limit the monitoring to the memory area
+	//
+	if (readfile(CONTEXT "/avail_operations", buf, sizeof buf) == -1)
+		buf[0] = 0;
+
+	if (strstr(buf, "fvaddr"))
+		ops = "fvaddr";
+	else if (strstr(buf, "vaddr"))
+		ops = "vaddr";
+	else {
+		fprintf(stderr, "DAMON virtual address operations not available "
+		                "(available: %s)\n", buf);
+		damonoff();
+		return 1;
+	}
+
+	if (writefile(CONTEXT "/operations", "%s", ops) == -1 ||
+	    writefile(CONTEXT "/monitoring_attrs/intervals/sample_us",
+	              "%ld", sample) == -1 ||
+	    writefile(CONTEXT "/monitoring_attrs/intervals/aggr_us",
+	              "%ld", aggr) == -1 ||
+	    writefile(CONTEXT "/monitoring_attrs/intervals/update_us",
+	              "%ld", update) == -1 ||
+	    writefile(CONTEXT "/monitoring_attrs/nr_regions/max",
+	              "%ld", maxreg) == -1 ||
+	    writefile(CONTEXT "/monitoring_attrs/nr_regions/min",
+	              "%ld", minreg) == -1 ||
+	    writefile(CONTEXT "/targets/nr_targets", "1") == -1 ||
+	    writefile(CONTEXT "/targets/0/pid_target", "%d", getpid()) == -1) {
+		perror("DAMON setup monitoring");
+		damonoff();
+		return 1;
+	}
+
+	if (strcmp(ops, "fvaddr") == 0 &&
+	    (writefile(CONTEXT "/targets/0/regions/nr_regions", "1") == -1 ||
+	     writefile(CONTEXT "/targets/0/regions/0/end", "%lu",
+	               (unsigned long)p + size) == -1 ||
+	     writefile(CONTEXT "/targets/0/regions/0/start", "%lu",
+	               (unsigned long)p) == -1)) {
+		perror("DAMON setup region");
+		damonoff();
+		return 1;
+	}
+
+	// scheme without action, only to obtain the regions
+	//
+	if (writefile(CONTEXT "/schemes/nr_schemes", "1") == -1 ||
+	    writefile(SCHEME "/action", "stat") == -1 ||
+	    writefile(SCHEME "/access_pattern/sz/max", "%lu", -1UL) == -1 ||
+	    writefile(SCHEME "/access_pattern/nr_accesses/max", "%u", -1U) == -1 ||
+	    writefile(SCHEME "/access_pattern/age/max", "%u", -1U) == -1) {
+		perror("DAMON setup scheme");
+		damonoff();
+		return 1;
+	}
+
+	if (writefile(KDAMONDS "/0/state", "on") == -1) {
+		perror("DAMON start kdamond");
+		damonoff();
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+** show the regions that DAMON found in the memory area next to the
+** intended pattern; adjacent regions with the same classification
+** are combined
+*/
+static void damonreport(char *p, struct uconf *cf, long sample, long aggr)
+{
+	unsigned long long	start, end, pstart = (unsigned long)p,
+				pend = (unsigned long)p + cf->virtual;
+	unsigned long long	bounds[4] = {0, cf->keepalive, cf->physical,
+				             cf->virtual};
+	long long		hotok = 0, coldok = 0, total = 0, nracc, age,
+				maxacc = aggr / sample;
+	long long		runstart = -1, runend = 0, runmin = 0,
+				runmax = 0, runage = 0;
+	int			i, c, runacc = 0, runclass = 0, nregions = 0;
+	static char		*classes[] = {"hot", "cold", "untouched"};
+
+	if (writefile(KDAMONDS "/0/state", "update_schemes_tried_regions") == -1) {
+		perror("DAMON update regions");
+		return;
+	}
+
+	printf("%-25s %-16s %-8s %s\n", "offset (KiB)", "accesses", "age",
+	       "intended");
+
+	for (i=0; ; i++) {
+		if ( (start = damonvalue("start", i)) == -1ULL)
+			break;
+
+		end   = damonvalue("end", i);
+		nracc = damonvalue("nr_accesses", i);
+		age   = damonvalue("age", i);
+
+		if (end <= pstart || start >= pend)
+			continue;
+
+		nregions++;
+
+		if (start < pstart)
+			start = pstart;
+
+		if (end > pend)
+			end = pend;
+
+		start -= pstart;
+		end   -= pstart;
+
+		// split the region on the boundaries of the intended pattern
+		//
+		for (c=0; c < 3; c++) {
+			unsigned long long	s, e;
+
+			s = start > bounds[c]   ? start : bounds[c];
+			e = end   < bounds[c+1] ? end   : bounds[c+1];
+
+			if (s >= e)
+				continue;
+
+			total += e - s;
+
+			if (c == 0 && nracc > 0)
+				hotok  += e - s;
+
+			if (c != 0 && nracc == 0)
+				coldok += e - s;
+
+			if (runstart != -1 && runclass == c &&
+			    runacc == (nracc > 0) && runend == s) {
+				runend = e;
+
+				if (nracc < runmin)
+					runmin = nracc;
+
+				if (nracc > runmax)
+					runmax = nracc;
+
+				if (age > runage)
+					runage = age;
+
+				continue;
+			}
+
+			if (runstart != -1)
+				printf("%11lld - %-11lld %6lld - %-7lld %-8lld %s\n",
+				       runstart/1024, runend/1024, runmin, runmax,
+				       runage, classes[runclass]);
+
+			runstart = s;
+			runend   = e;
+			runmin   = runmax = nracc;
+			runage   = age;
+			runclass = c;
+			runacc   = nracc > 0;
+		}
+	}
+
+	if (runstart != -1)
+		printf("%11lld - %-11lld %6lld - %-7lld %-8lld %s\n",
+		       runstart/1024, runend/1024, runmin, runmax,
+		       runage, classes[runclass]);
+
+	printf("%d DAMON regions (max %lld accesses per aggregation), "
+	       "monitored %lld of %lld KiB\n", nregions, maxacc,
+	       total/1024, cf->virtual/1024);
+
+	printf("hot detected as accessed: %.1f%%, cold/untouched detected as "
+	       "idle: %.1f%%, accuracy: %.1f%%\n",
+	       cf->keepalive ? hotok * 100.0 / cf->keepalive : 100.0,
+	       cf->virtual > cf->keepalive ?
+	           coldok * 100.0 / (cf->virtual - cf->keepalive) : 100.0,
+	       (hotok + coldok) * 100.0 / cf->virtual);
+}
+
+/*
+** obtain a value of a tried region of the scheme or
+** of kdamond 0 (index -1)
+*/
+static long long damonvalue(const char *name, int index)
+{
+	char	path[256], buf[64];
+
+	if (index >= 0)
+		snprintf(path, sizeof path, SCHEME "/tried_regions/%d/%s",
+		         index, name);
+	else
+		snprintf(path, sizeof path, KDAMONDS "/0/%s", name);
+
+	if (readfile(path, buf, sizeof buf) == -1)
+		return -1;
+
+	return strtoull(buf, NULL, 10);
+}
+
+/*
+** obtain the CPU consumption (user + system) of kdamond 0 in ticks
+*/
+static long long cputicks(void)
+{
+	char		path[64], buf[1024], *s;
+	long long	pid, utime, stime;
+	FILE		*fp;
+
+	if ( (pid = damonvalue("pid", -1)) <= 0)
+		return -1;
+
+	snprintf(path, sizeof path, "/proc/%lld/stat", pid);
+
+	if ( (fp = fopen(path, "r")) == NULL)
+		return -1;
+
+	s = fgets(buf, sizeof buf, fp);
+	fclose(fp);
+
+	// fields utime and stime follow the command name and 11 fields
+	//
+	if (!s || (s = strrchr(buf, ')')) == NULL ||
+	    sscanf(s+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lld %lld",
+	           &utime, &stime) != 2)
+		return -1;
+
+	return utime + stime;
+}
+
+/*
+** switch off DAMON and remove the configuration
+*/
+static void damonoff(void)
+{
+	(void) writefile(KDAMONDS "/0/state", "off");
+	(void) writefile(KDAMONDS "/nr_kdamonds", "0");
+}
+
+/*
+** thread: keep the hot part of the memory area referenced
+*/
+static void *hotthread(void *arg)
+{
+	for (;;) {
+		memset(hotarea, 'X', hotsize);
+
+		if (hotdelay)
+			usleep(hotdelay * 1000);
+	}
+
+	return NULL;
+}
+
+static void catchstop(int sig)
+{
+	stop = 1;
+}
@@ -0,0 +1,235 @@
+/* density.c
+**
+** Measurement mode 'density': per-process kernel overhead of
+** thousands of small processes
+**
+** Usage: usemem -x density [-o options] [-m|-s|-S] [flags]
+**                                     virtsize [physsize [alivesize]]
+**
+**   Many child processes are forked that each allocate virtsize,
+**   reference physsize once and alivesize each second (like usemem
+**   itself).  The fork time is measured, as well as the increase of
+**   PageTables, KernelStack and Slab of /proc/meminfo per process.
+**   Periodically the resident and swapped size of the children is
+**   shown to observe how reclaim spreads over them.
+**
+** Options (-o):
+**   procs=n	number of processes (default 1000)
+**   interval=sec	report interval in seconds (default 10)
+**   duration=sec	duration after which all processes are terminated
+**		(default 0: until interrupted)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "usemem.h"
+
+static char *kernelfields[] = {
+	"PageTables:", "KernelStack:", "Slab:", "AnonPages:",
+};
+
+#define	NFIELDS		(sizeof kernelfields / sizeof kernelfields[0])
+
+static volatile sig_atomic_t	stop;
+
+static void		tinyproc(struct uconf *, int);
+static void		densityreport(pid_t *, int);
+static void		catchstop(int);
+
+int
+densitymode(struct uconf *cf)
+{
+	pid_t			*pids;
+	int			nprocs, interval, duration, i, pfd[2];
+	long long		before[NFIELDS];
+	unsigned long long	start, forked, ready, t;
+	char			c;
+
+	nprocs   = modeoptnum(cf, "procs",    1000);
+	interval = modeoptnum(cf, "interval", 10);
+	duration = modeoptnum(cf, "duration", 0);
+
+	if (nprocs <= 0 || interval <= 0 || duration < 0) {
+		fprintf(stderr, "invalid options for density mode\n");
+		return 1;
+	}
+
+	if ( (pids = calloc(nprocs, sizeof *pids)) == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (pipe(pfd) == -1) {
+		perror("pipe");
+		return 1;
+	}
+
+	for (i=0; i < NFIELDS; i++)
+		before[i] = procvalue("/proc/meminfo", kernelfields[i]);
+
+	signal(SIGINT,  catchstop);
+	signal(SIGTERM, catchstop);
+	fflush(stdout);
+
+	// fork all processes, that signal via the pipe
+	// when their memory has been referenced
+	//
+	start = nanotime();
+
+	for (i=0; i < nprocs; i++) {
+		if ( (pids[i] = fork()) == -1) {
+			perror("fork");
+			break;		// continue with the processes so far
+		}
+
+		if (pids[i] == 0) {
+			close(pfd[0]);
+			tinyproc(cf, pfd[1]);
+			exit(0);
+		}
+	}
+
+	nprocs = i;
+
+	forked = nanotime();
+
+	close(pfd[1]);
+
+	for (i=0; i < nprocs; i++)
+		if (read(pfd[0], &c, 1) != 1)
+			break;
+
+	ready = nanotime();
+
+	printf("%d processes forked in %.3f sec (%.1f us per fork), "
+	       "ready in %.3f sec\n", nprocs, (forked - start) / 1e9,
+	       (forked - start) / 1e3 / nprocs, (ready - start) / 1e9);
+
+	printf("increase per process:");
+
+	for (i=0; i < NFIELDS; i++)
+		printf(" %.*s %.1f KiB%s", (int)strlen(kernelfields[i]) - 1,
+		       kernelfields[i],
+		       (double)(procvalue("/proc/meminfo", kernelfields[i]) -
+		                before[i]) / nprocs,
+		       i < NFIELDS-1 ? "," : "\n");
+
+	fflush(stdout);
+
+	// follow the resident and swapped size of the processes
+	//
+	for (t = nanotime(); !stop; ) {
+		densityreport(pids, nprocs);
+		sleep(interval);
+
+		if (duration && nanotime() - t >= duration * 1000000000ULL)
+			break;
+	}
+
+	for (i=0; i < nprocs; i++)
+		kill(pids[i], SIGTERM);
+
+	while (wait(NULL) > 0)
+		;
+
+	return 0;
+}
+
+/*
+** child: allocate and reference memory, signal the parent
+** and keep referencing alivesize
+*/
+static void tinyproc(struct uconf *cf, int fd)
+{
+	char	*p, *msg;
+
+	signal(SIGINT,  SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		exit(1);
+	}
+
+	preadvise(cf, p, cf->virtual);
+
+	if (cf->physical)
+		memset(p, 'X', cf->physical);
+
+	postadvise(cf, p, cf->virtual);
+
+	if (write(fd, "r", 1) != 1)
+		exit(1);
+
+	close(fd);
+
+	if (!cf->keepalive) {
+		for (;;)
+			pause();
+	}
+
+	for (;;) {
+		sleep(1);
+		memset(p, 'X', cf->keepalive);
+	}
+}
+
+/*
+** show the distribution of resident and swapped size
+** over the processes
+*/
+static void densityreport(pid_t *pids, int nprocs)
+{
+	unsigned long long	*rss;
+	long long		totrss = 0, totswap = 0, v;
+	int			i, n = 0, nswap = 0;
+	char			path[64];
+
+	if ( (rss = malloc(nprocs * sizeof *rss)) == NULL)
+		return;
+
+	for (i=0; i < nprocs; i++) {
+		snprintf(path, sizeof path, "/proc/%d/status", pids[i]);
+
+		if ( (v = procvalue(path, "VmRSS:")) == -1)
+			continue;	// terminated
+
+		rss[n++] = v;
+		totrss  += v;
+
+		if ( (v = procvalue(path, "VmSwap:")) > 0) {
+			totswap += v;
+			nswap++;
+		}
+	}
+
+	latsort(rss, n);
+
+	printf("%d alive: RSS min %llu / median %llu / max %llu KiB, "
+	       "total %lld KiB; swapped %lld KiB by %d processes, "
+	       "PageTables %lld KiB\n", n, latpct(rss, n, 0),
+	       latpct(rss, n, 50), latpct(rss, n, 100), totrss,
+	       totswap, nswap, procvalue("/proc/meminfo", "PageTables:"));
+	fflush(stdout);
+
+	free(rss);
+}
+
+static void catchstop(int sig)
+{
+	stop = 1;
+}
@@ -0,0 +1,234 @@
+/* dirty.c
+**
+** Measurement mode 'dirty': stalls of writers caused by throttling of
+** dirty pages (balance_dirty_pages) and by msync
+**
+** Usage: usemem -x dirty -o file=path[,...] virtsize
+**
+**   The memory area is a shared mapping of a file (option file).  It is
+**   dirtied cyclically in batches at a target rate, while every store
+**   batch and msync is timed.  Shared memory (flag -s or -S) is not
+**   accepted: shmem pages are not subject to balance_dirty_pages.
+**   Each second the batch latencies are shown together with Dirty and
+**   Writeback of /proc/meminfo and the dirty thresholds of /proc/vmstat.
+**   A batch is counted as throttled when it is slower than the stall
+**   threshold while the dirty pages are above the 'freerun' ceiling
+**   (halfway between background and dirty threshold) from where
+**   balance_dirty_pages starts to throttle.
+**
+** Options (-o):
+**   file=path	file to be mapped (created/truncated to virtsize)
+**   rate=sz	bytes to be dirtied per second (default 0: unlimited)
+**   batch=sz	bytes per store batch (default 1M)
+**   msync=n	msync the dirtied range after every n batches
+**		(default 0: no msync)
+**   async	use MS_ASYNC instead of MS_SYNC
+**   stall=us	latency threshold for a stalled batch (default 10000)
+**   duration=sec	duration of the measurement (default 30)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "usemem.h"
+
+static unsigned long long	timedsync(char *, long long, int);
+
+int
+dirtymode(struct uconf *cf)
+{
+	char			*p, *file;
+	int			fd, duration, msyncflag, nsync;
+	long long		rate, batch, msyncn, stall, off, synced;
+	long long		dirtied, nlat, maxlat, stalls, throttled,
+				freerun, dirty, syncmax, nbatches;
+	unsigned long long	*lat, t, start, second, tbatch;
+	long			pagesize = cf->pagesize;
+
+	file      = modeopt(cf, "file") ? strdup(modeopt(cf, "file")) : NULL;
+	rate      = modeoptnum(cf, "rate",     0);
+	batch     = modeoptnum(cf, "batch",    1024*1024);
+	msyncn    = modeoptnum(cf, "msync",    0);
+	msyncflag = modeopt(cf, "async") ? MS_ASYNC : MS_SYNC;
+	stall     = modeoptnum(cf, "stall",    10000) * 1000;
+	duration  = modeoptnum(cf, "duration", 30);
+
+	batch = (batch + pagesize - 1) / pagesize * pagesize;
+
+	if (rate < 0 || batch <= 0 || batch > cf->virtual || msyncn < 0 ||
+	    duration <= 0) {
+		fprintf(stderr, "invalid options for dirty mode\n");
+		return 1;
+	}
+
+	if (!file || cf->alloctype != 'a') {
+		fprintf(stderr, "dirty mode requires option file "
+		                "(and no memory type flag)\n");
+		return 1;
+	}
+
+	// map the file
+	//
+	if ( (fd = open(file, O_RDWR|O_CREAT|O_TRUNC, 0600)) == -1) {
+		perror(file);
+		return 1;
+	}
+
+	if (ftruncate(fd, cf->virtual) == -1) {
+		perror("ftruncate");
+		return 1;
+	}
+
+	p = mmap(NULL, cf->virtual, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (p == MAP_FAILED) {
+		perror("mmap of file");
+		return 1;
+	}
+
+	close(fd);
+
+	preadvise(cf, p, cf->virtual);
+
+	nlat = rate ? rate / batch * 2 + 16 : 4096;
+
+	if ( (lat = malloc(nlat * sizeof *lat)) == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%lld KiB mapped (%s), dirtied in batches of %lld KiB",
+	       cf->virtual/1024, file, batch/1024);
+
+	if (rate)
+		printf(" at %lld KiB/s\n", rate/1024);
+	else
+		printf(" at maximum rate\n");
+
+	printf("%4s %10s %9s %9s %9s %7s %7s %9s %10s %10s %10s\n",
+	       "sec", "KiB/s", "p50 us", "p99 us", "max us", "stalls",
+	       "thrott", "msync us", "Dirty KiB", "Writeb KiB", "freerun KiB");
+
+	start    = second = nanotime();
+	off      = synced = 0;
+	dirtied  = nbatches = maxlat = stalls = throttled = syncmax = 0;
+	nsync    = 0;
+	freerun  = (procvalue("/proc/vmstat", "nr_dirty_threshold") +
+	            procvalue("/proc/vmstat", "nr_dirty_background_threshold")) / 2;
+
+	while (second - start < duration * 1000000000ULL) {
+		// dirty one batch cyclically through the area
+		//
+		if (off + batch > cf->virtual) {
+			if (msyncn && synced < cf->virtual) {	// tail before wrap
+				if ( (t = timedsync(p + synced,
+				                    cf->virtual - synced,
+				                    msyncflag)) > syncmax)
+					syncmax = t;
+			}
+
+			off = synced = 0;
+		}
+
+		t = nanotime();
+		memset(p + off, 'D', batch);
+		tbatch = nanotime() - t;
+
+		if (nbatches < nlat)
+			lat[nbatches] = tbatch;
+
+		if (tbatch > maxlat)
+			maxlat = tbatch;
+
+		nbatches++;
+		dirtied += batch;
+		off     += batch;
+
+		if (tbatch > stall) {
+			stalls++;
+
+			// compare the dirty pages (in pages) with the ceiling
+			//
+			dirty = procvalue("/proc/vmstat", "nr_dirty");
+
+			if (dirty >= freerun)
+				throttled++;
+		}
+
+		// msync the range dirtied since the previous msync
+		//
+		if (msyncn && ++nsync >= msyncn) {
+			if ( (t = timedsync(p + synced, off - synced,
+			                    msyncflag)) > syncmax)
+				syncmax = t;
+
+			synced = off;
+			nsync  = 0;
+		}
+
+		// report each second
+		//
+		t = nanotime();
+
+		if (t - second >= 1000000000ULL) {
+			long long	n = nbatches < nlat ? nbatches : nlat;
+
+			latsort(lat, n);
+
+			freerun = (procvalue("/proc/vmstat", "nr_dirty_threshold") +
+			           procvalue("/proc/vmstat",
+			                     "nr_dirty_background_threshold")) / 2;
+
+			printf("%4llu %10.0f %9.1f %9.1f %9.1f %7lld %7lld %9.1f "
+			       "%10lld %10lld %10lld\n",
+			       (t - start) / 1000000000ULL,
+			       dirtied / 1024.0 / ((t - second) / 1e9),
+			       latpct(lat, n, 50) / 1e3, latpct(lat, n, 99) / 1e3,
+			       maxlat / 1e3, stalls, throttled, syncmax / 1e3,
+			       procvalue("/proc/meminfo", "Dirty:"),
+			       procvalue("/proc/meminfo", "Writeback:"),
+			       freerun * pagesize / 1024);
+			fflush(stdout);
+
+			second   = t;
+			dirtied  = nbatches = maxlat = stalls = throttled = 0;
+			syncmax  = 0;
+		}
+
+		// pace to the target rate
+		//
+		if (rate) {
+			unsigned long long	due;
+
+			due = second + dirtied * 1000000000ULL / rate;
+
+			if (due > t)
+				usleep((due - t) / 1000);
+		}
+	}
+
+	return 0;
+}
+
+/*
+** msync a range and return its duration in nanoseconds
+*/
+static unsigned long long timedsync(char *p, long long len, int flag)
+{
+	unsigned long long	t = nanotime();
+
+	(void) msync(p, len, flag);
+
+	return nanotime() - t;
+}
@@ -0,0 +1,291 @@
+/* exectext.c
+**
+** Measurement mode 'exectext': refaults and fetch latency of executable
+** file pages (program text) while anonymous memory pressure rises
+**
+** Usage: usemem -x exectext [-o options] [-m|-s|-S] [flags] virtsize
+**
+**   An executable file (or a generated file of the size of option text)
+**   is mapped with PROT_READ|PROT_EXEC and accessed like instruction
+**   fetches: a run of consecutive cache lines from a random page, and
+**   then a jump to another page.  Meanwhile an anonymous area of virtsize
+**   is referenced in steps (every interval another part) and all
+**   referenced pages are accessed again every interval, so the text
+**   competes with an increasing amount of active anonymous memory.
+**   Without swap only the file pages can be reclaimed.
+**
+**   For every step the text resident in the page cache (mincore), the
+**   text mapped by huge pages (FilePmdMapped, only with option thp and
+**   a kernel that supports read-only file THP), the file refaults
+**   (/proc/vmstat), the major faults of the process, and the rate and
+**   latency of the fetch runs are shown.  To validate the preferential
+**   treatment that the kernel gives to pages of executable mappings
+**   (VM_EXEC), the same can be done with prot=read for comparison.
+**
+**   A generated file is created in dir, removed again after mapping,
+**   and dropped from the page cache before the first (cold) pass.
+**   Notice that a file on tmpfs cannot be reclaimed without swap.
+**
+** Options (-o):
+**   file=path	executable file to map (default: generated file)
+**   text=sz	size of generated file (default 64M)
+**   dir=path	directory for generated file (default /var/tmp)
+**   prot=type	exec or read mapping (default exec)
+**   thp	advise transparent huge pages for the text (MADV_HUGEPAGE)
+**   run=n	cache lines per fetch run (default 16)
+**   steps=n	number of pressure steps (default 10)
+**   interval=sec	duration per step (default 1)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "usemem.h"
+
+#ifndef	MADV_HUGEPAGE
+#define	MADV_HUGEPAGE	0	// ignore if not supported
+#endif
+
+#define	MAXLAT		(1024*1024)	// latency samples per step
+
+static int		gentext(char *, long long);
+static long long	refaults(void);
+static long		majflt(void);
+
+int
+exectextmode(struct uconf *cf)
+{
+	char			*anon, *text, *msg, *file, *dir, *prot, *pg,
+				path[1024];
+	long long		textsize, pagesize = cf->pagesize, step, done,
+				off, rf, npages;
+	int			fd, exec, thp, run, steps, interval, i, l;
+	long			mf, n, nlat;
+	struct stat		st;
+	struct rollup		ru;
+	unsigned long long	*lat, rnd = 1, t, tend, sum = 0;
+
+	file     = modeopt(cf, "file") ? strdup(modeopt(cf, "file")) : NULL;
+	dir      = strdup(modeopt(cf, "dir")  ? modeopt(cf, "dir")  : "/var/tmp");
+	prot     = strdup(modeopt(cf, "prot") ? modeopt(cf, "prot") : "exec");
+	textsize = modeoptnum(cf, "text",     64*1024*1024);
+	thp      = modeopt(cf, "thp") != NULL;
+	run      = modeoptnum(cf, "run",      16);
+	steps    = modeoptnum(cf, "steps",    10);
+	interval = modeoptnum(cf, "interval", 1);
+	exec     = strcmp(prot, "exec") == 0;
+
+	if ((!exec && strcmp(prot, "read")) || textsize < pagesize ||
+	    run <= 0 || run * 64 > pagesize || steps <= 0 || interval <= 0) {
+		fprintf(stderr, "invalid options for exectext mode\n");
+		return 1;
+	}
+
+	if ( (lat = malloc(MAXLAT * sizeof *lat)) == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	// open the executable file or generate one
+	//
+	if (!file) {
+		snprintf(path, sizeof path, "%s/usemem-text.XXXXXX", dir);
+
+		if ( (fd = gentext(path, textsize)) == -1) {
+			perror(path);
+			return 1;
+		}
+
+		file = path;
+	} else if ( (fd = open(file, O_RDONLY)) == -1) {
+		perror(file);
+		return 1;
+	}
+
+	if (fstat(fd, &st) == -1 || st.st_size < pagesize) {
+		fprintf(stderr, "%s: too small to map\n", file);
+		close(fd);
+
+		if (file == path)
+			(void) unlink(path);
+
+		return 1;
+	}
+
+	textsize = st.st_size / pagesize * pagesize;
+
+	text = mmap(NULL, textsize, PROT_READ | (exec ? PROT_EXEC : 0),
+	            MAP_PRIVATE, fd, 0);
+
+	if (text == MAP_FAILED) {
+		perror("mmap of text (noexec mount?)");
+		close(fd);
+
+		if (file == path)
+			(void) unlink(path);
+
+		return 1;
+	}
+
+	if (file == path)
+		(void) unlink(path);
+
+	if (thp)
+		do_advise("thp", MADV_HUGEPAGE, text, textsize);
+
+	// cold pass over the text
+	//
+	(void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+
+	npages = textsize / pagesize;
+	t      = nanotime();
+
+	for (off=0; off < textsize; off += pagesize)
+		sum += ((volatile char *)text)[off];
+
+	t = nanotime() - t;
+
+	if ( (anon = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	preadvise(cf, anon, cf->virtual);
+
+	printf("text: %lld KiB of %s (prot %s%s), cold pass %.1f ms\n",
+	       textsize/1024, file == path ? "generated file" : file, prot,
+	       thp ? ", thp" : "", t / 1e6);
+	printf("anon: up to %lld KiB (%s) in %d steps of %d sec, "
+	       "fetch runs of %d lines\n", cf->virtual/1024, msg, steps,
+	       interval, run);
+	printf("%4s %12s %12s %10s %10s %8s %10s %8s %8s %9s\n", "step",
+	       "anon KiB", "text KiB", "pmd KiB", "refaults", "majflt",
+	       "runs/s", "p50 us", "p99 us", "max us");
+	fflush(stdout);
+
+	// step 0 without pressure as baseline
+	//
+	for (i=0, done=0; i <= steps; i++) {
+		step = cf->virtual / steps / pagesize * pagesize;
+
+		if (i == steps)
+			step = cf->virtual - done;
+
+		rf = refaults();
+		mf = majflt();
+
+		if (i > 0) {
+			memset(anon + done, 'X', step);
+			done += step;
+		}
+
+		// keep the anonymous pages active and fetch text
+		// for the remainder of the interval
+		//
+		for (off=0; off < done; off += pagesize)
+			sum += ((volatile char *)anon)[off];
+
+		tend = nanotime() + interval * 1000000000ULL;
+
+		for (n=0, nlat=0; (t = nanotime()) < tend; n++) {
+			rnd = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			pg  = text + (long long)((rnd >> 16) % npages) * pagesize;
+
+			for (l=0; l < run; l++)
+				sum += ((volatile char *)pg)[l * 64];
+
+			if (nlat < MAXLAT)
+				lat[nlat++] = nanotime() - t;
+		}
+
+		latsort(lat, nlat);
+
+		rollup(&ru);
+
+		printf("%4d %12lld %12lld %10lld %10lld %8ld %10ld %8.2f %8.2f "
+		       "%9.1f\n", i, done/1024,
+		       residentbytes(text, textsize)/1024,
+		       ru.filepmd > 0 ? ru.filepmd : 0, refaults() - rf,
+		       majflt() - mf, n / interval,
+		       latpct(lat, nlat, 50) / 1e3, latpct(lat, nlat, 99) / 1e3,
+		       nlat ? lat[nlat-1] / 1e3 : 0);
+		fflush(stdout);
+	}
+
+	if (sum == 0)		// prevent optimizing away
+		printf("\n");
+
+	freemem(cf, anon, cf->virtual);
+	(void) munmap(text, textsize);
+
+	return 0;
+}
+
+/*
+** generate a file of the given size (path is a mkstemp template)
+** returns the file descriptor (read-only) or -1 with errno set
+*/
+static int gentext(char *path, long long size)
+{
+	static char	buf[1024*1024];
+	long long	off, len;
+	int		fd, rfd;
+
+	if ( (fd = mkstemp(path)) == -1)
+		return -1;
+
+	memset(buf, 0xc3, sizeof buf);	// 'ret' on x86
+
+	for (off=0; off < size; off += len) {
+		len = size - off < sizeof buf ? size - off : sizeof buf;
+
+		if (write(fd, buf, len) != len) {
+			close(fd);
+			(void) unlink(path);
+			return -1;
+		}
+	}
+
+	fsync(fd);
+
+	rfd = open(path, O_RDONLY);
+	close(fd);
+
+	return rfd;
+}
+
+/*
+** file refaults of the workingset (older kernels only have the total)
+*/
+static long long refaults(void)
+{
+	long long	n;
+
+	if ( (n = procvalue("/proc/vmstat", "workingset_refault_file")) == -1)
+		n = procvalue("/proc/vmstat", "workingset_refault");
+
+	return n;
+}
+
+static long majflt(void)
+{
+	struct rusage	ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	return ru.ru_majflt;
+}
@@ -0,0 +1,169 @@
+/* hugemix.c
+**
+** Huge pages with fallback (flag -H): the area is mapped per chunk with
+** the largest page size that can be obtained, in the order
+**
+**	1 GiB hugetlb page (MAP_HUGETLB|MAP_HUGE_1GB)
+**	2 MiB hugetlb page (MAP_HUGETLB|MAP_HUGE_2MB)
+**	transparent huge page (anonymous memory with MADV_HUGEPAGE)
+**	base pages (remainder that is not huge page aligned)
+**
+** A hugetlb mapping reserves its huge pages when mapped, so an empty
+** pool leads to the next alternative instead of a failure.  Whether a
+** transparent huge page is obtained is only known when referenced, so
+** the mix is shown after mapping and again after referencing.
+** Transparent huge pages are skipped with flag -n, or when the kernel
+** headers do not know MADV_HUGEPAGE.
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "usemem.h"
+
+#ifndef	MAP_HUGE_SHIFT
+#define	MAP_HUGE_SHIFT	26
+#endif
+
+#ifndef	MAP_HUGE_2MB
+#define	MAP_HUGE_2MB	(21 << MAP_HUGE_SHIFT)
+#endif
+
+#ifndef	MAP_HUGE_1GB
+#define	MAP_HUGE_1GB	(30 << MAP_HUGE_SHIFT)
+#endif
+
+#ifndef	MADV_HUGEPAGE
+#define	MADV_HUGEPAGE	0	// ignore if not supported
+#endif
+
+#define	GPAGESIZE	(1024LL*1024*1024)
+
+static char		*area;
+static long long	areasize;
+static long long	n1g, n2m, thpbytes, basebytes;	// mix after mapping
+
+static int		mapchunk(char *, long long, int);
+
+/*
+** map the area with the huge page fallback chain
+** returns NULL on failure with msg referring to the failing call
+*/
+char *hugemixalloc(struct uconf *cf, long long size, char **msg)
+{
+	char		*r, *p;
+	long long	off, len;
+	int		thp = !cf->nflag && MADV_HUGEPAGE != 0;
+
+	if (!cf->nflag && !thp)
+		fprintf(stderr, "warning: THP advise for -H not supported "
+		                "(ignored)\n");
+
+	// reserve an address range aligned on 1 GiB and release
+	// the parts before and after the area
+	//
+	*msg = "mmap reservation for -H";
+
+	r = mmap(NULL, size + GPAGESIZE, PROT_NONE,
+	         MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+
+	if (r == MAP_FAILED)
+		return NULL;
+
+	p = (char *)(((unsigned long)r + GPAGESIZE - 1) / GPAGESIZE * GPAGESIZE);
+
+	if (p > r)
+		(void) munmap(r, p - r);
+
+	(void) munmap(p + size, r + size + GPAGESIZE - (p + size));
+
+	// replace the reservation chunk by chunk
+	//
+	n1g = n2m = thpbytes = basebytes = 0;
+	*msg = "mmap for -H";
+
+	for (off=0; off < size; off += len) {
+		if (off % GPAGESIZE == 0 && size - off >= GPAGESIZE &&
+		    mapchunk(p + off, GPAGESIZE, MAP_HUGETLB|MAP_HUGE_1GB) == 0) {
+			len = GPAGESIZE;
+			n1g++;
+			continue;
+		}
+
+		if (size - off >= HPAGESIZE &&
+		    mapchunk(p + off, HPAGESIZE, MAP_HUGETLB|MAP_HUGE_2MB) == 0) {
+			len = HPAGESIZE;
+			n2m++;
+			continue;
+		}
+
+		len = size - off < HPAGESIZE ? size - off : HPAGESIZE;
+
+		if (mapchunk(p + off, len, 0) == -1) {
+			(void) munmap(p, size);
+			return NULL;
+		}
+
+		if (len == HPAGESIZE && thp &&
+		    madvise(p + off, len, MADV_HUGEPAGE) == 0)
+			thpbytes  += len;
+		else
+			basebytes += len;
+	}
+
+	*msg     = "mmap with huge page fallback";
+	area     = p;
+	areasize = size;
+
+	printf("huge page mix mapped: %lld x 1 GiB hugetlb, %lld x 2 MiB "
+	       "hugetlb, %lld KiB THP-eligible, %lld KiB base pages\n",
+	       n1g, n2m, thpbytes/1024, basebytes/1024);
+	fflush(stdout);
+
+	return p;
+}
+
+/*
+** show the mix obtained after referencing: the THP-eligible part
+** is split in transparent huge pages and base pages
+*/
+void hugemixstat(void)
+{
+	struct rollup	ru;
+	long long	thp;
+
+	if (rollup(&ru) == -1 || ru.anonhuge < 0)
+		return;
+
+	thp = ru.anonhuge * 1024;
+
+	if (thp > thpbytes)		// other anonymous memory of usemem
+		thp = thpbytes;
+
+	printf("huge page mix obtained: %lld KiB 1 GiB hugetlb, %lld KiB "
+	       "2 MiB hugetlb, %lld KiB THP, %lld KiB base pages\n",
+	       n1g * GPAGESIZE / 1024, n2m * HPAGESIZE / 1024, thp / 1024,
+	       (thpbytes - thp + basebytes) / 1024);
+	printf("area consists of %ld mappings\n", vmacount(area, areasize));
+	fflush(stdout);
+}
+
+/*
+** map one chunk at a fixed address in the reservation
+*/
+static int mapchunk(char *addr, long long len, int flags)
+{
+	char	*p;
+
+	p = mmap(addr, len, PROT_READ|PROT_WRITE,
+	         MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|flags, -1, 0);
+
+	return p == MAP_FAILED ? -1 : 0;
+}
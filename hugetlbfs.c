@@ -0,0 +1,248 @@
+/* hugetlbfs.c
+**
+** Memory type hugetlbfs file (flag -F): a file on a hugetlbfs mount,
+** preallocated with fallocate() and mapped shared
+**
+**   -F path	path is one of:
+**		- an existing file on hugetlbfs, that is attached (e.g. by
+**		  a second usemem) and extended when it is too small
+**		- a new file on hugetlbfs, that is created and kept
+**		  (remove it to release the huge pages)
+**		- a directory on hugetlbfs, in which a temporary file
+**		  is created that is removed when detached
+**		- a huge page size (e.g. 2M or 1G), to use a temporary
+**		  file on the hugetlbfs mount with that page size
+**		  (a relative path without '/' that starts with a
+**		  digit must be given as e.g. ./2M)
+**
+** The huge page size is determined by the mount.  The time of the
+** preallocation is shown per GiB, and the reserved, used and free
+** huge pages of that size are shown after mapping and referencing.
+** The mapping is rounded up to the huge page size; hugetlbfssize()
+** gives the rounded size to unmap it.
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "usemem.h"
+
+#ifndef	HUGETLBFS_MAGIC
+#define	HUGETLBFS_MAGIC	0x958458f6
+#endif
+
+static long		hpagesize;	// huge page size of the mount
+
+static int		findmount(const char *, char *, size_t);
+static long long	poolvalue(const char *, const char *);
+
+/*
+** map a (preallocated) file on hugetlbfs
+** returns NULL on failure with msg referring to the failing call
+** (a file created here is removed again on failure)
+*/
+char *hugetlbfsalloc(struct uconf *cf, long long size, char **msg)
+{
+	static char		path[PATH_MAX],	// static: referred to by msg
+				errmsg[PATH_MAX+32];
+	char			dir[PATH_MAX], *p;
+	int			fd, tmp = 0, created;
+	struct stat		st;
+	struct statfs		fs;
+	unsigned long long	t;
+
+	// resolve the pathname of the file
+	//
+	if (isdigit(cf->hugetlbfs[0]) && !strchr(cf->hugetlbfs, '/')) {
+		if (findmount(cf->hugetlbfs, path, sizeof path) == -1) {
+			snprintf(errmsg, sizeof errmsg, "hugetlbfs mount with "
+			         "page size %s", cf->hugetlbfs);
+			*msg = errmsg;
+			return NULL;
+		}
+	} else {
+		snprintf(path, sizeof path, "%s", cf->hugetlbfs);
+	}
+
+	// verify the file system before anything is created
+	//
+	snprintf(dir, sizeof dir, "%s", path);
+
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+		snprintf(path + strlen(path), sizeof path - strlen(path),
+		         "/usemem.%d", getpid());
+		tmp = 1;
+	} else if ( (p = strrchr(dir, '/')) ) {
+		*(p == dir ? p+1 : p) = 0;	// directory of the file
+	} else {
+		snprintf(dir, sizeof dir, ".");
+	}
+
+	*msg = path;
+
+	if (statfs(dir, &fs) == -1)
+		return NULL;
+
+	if (fs.f_type != HUGETLBFS_MAGIC) {
+		snprintf(errmsg, sizeof errmsg, "%s (not on hugetlbfs)", path);
+		*msg  = errmsg;
+		errno = EINVAL;
+		return NULL;
+	}
+
+	created = stat(path, &st) == -1;
+
+	if ( (fd = open(path, O_RDWR|O_CREAT, 0600)) == -1)
+		return NULL;
+
+	hpagesize = fs.f_bsize;
+	size      = (size + hpagesize - 1) / hpagesize * hpagesize;
+
+	// preallocate when the file is new or too small
+	//
+	if (fstat(fd, &st) == 0 && st.st_size < size) {
+		*msg = "fallocate on hugetlbfs";
+		t    = nanotime();
+
+		if (fallocate(fd, 0, 0, size) == -1) {
+			close(fd);
+
+			if (created || tmp)
+				unlink(path);
+
+			return NULL;
+		}
+
+		t = nanotime() - t;
+
+		printf("%lld KiB preallocated with %ld KiB pages in %.3f sec "
+		       "(%.3f sec per GiB)\n", (size - st.st_size) / 1024,
+		       hpagesize / 1024, t / 1e9,
+		       t / 1e9 / ((size - st.st_size) / 1073741824.0));
+	} else {
+		printf("%lld KiB attached with %ld KiB pages\n",
+		       (long long)st.st_size / 1024, hpagesize / 1024);
+	}
+
+	*msg = "mmap for hugetlbfs";
+	p    = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (tmp || (created && p == MAP_FAILED))
+		unlink(path);	// destroy when detached
+
+	if (p == MAP_FAILED)
+		return NULL;
+
+	*msg = "hugetlbfs";
+	hugetlbfsstat();
+
+	return p;
+}
+
+/*
+** size of a mapping on hugetlbfs (rounded up to the huge page size)
+*/
+long long hugetlbfssize(long long size)
+{
+	if (hpagesize == 0)
+		return size;
+
+	return (size + hpagesize - 1) / hpagesize * hpagesize;
+}
+
+/*
+** show the state of the huge page pool of the page size in use
+*/
+void hugetlbfsstat(void)
+{
+	char		dir[128];
+	long long	nr, freepages, resv, surplus;
+
+	snprintf(dir, sizeof dir, "/sys/kernel/mm/hugepages/hugepages-%ldkB/",
+	         hpagesize / 1024);
+
+	nr        = poolvalue(dir, "nr_hugepages");
+	freepages = poolvalue(dir, "free_hugepages");
+	resv      = poolvalue(dir, "resv_hugepages");
+	surplus   = poolvalue(dir, "surplus_hugepages");
+
+	printf("huge pages of %ld KiB: total %lld, in use %lld, reserved %lld "
+	       "(not yet in use), free %lld (unreserved %lld), surplus %lld\n",
+	       hpagesize / 1024, nr, nr - freepages, resv, freepages,
+	       freepages - resv, surplus);
+	fflush(stdout);
+}
+
+/*
+** find the hugetlbfs mount with the given page size (e.g. "2M"),
+** where a mount without pagesize option uses the default size
+** returns -1 when not found (errno set)
+*/
+static int findmount(const char *pagesize, char *dir, size_t len)
+{
+	FILE		*fp;
+	char		line[PATH_MAX], mnt[PATH_MAX/2], fstype[32],
+			opts[PATH_MAX/4], *s;
+	long long	want = getnum(pagesize), size;
+
+	if ( (fp = fopen("/proc/mounts", "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof line, fp)) {
+		if (sscanf(line, "%*s %2047s %31s %1023s", mnt, fstype, opts) != 3 ||
+		    strcmp(fstype, "hugetlbfs"))
+			continue;
+
+		if ( (s = strstr(opts, "pagesize=")) ) {
+			s    = strndup(s+9, strcspn(s+9, ","));
+			size = getnum(s);
+			free(s);
+		} else {
+			size = procvalue("/proc/meminfo", "Hugepagesize:") * 1024;
+		}
+
+		if (size == want) {
+			fclose(fp);
+			snprintf(dir, len, "%s", mnt);
+			return 0;
+		}
+	}
+
+	fclose(fp);
+	errno = ENOENT;
+	return -1;
+}
+
+/*
+** obtain a counter of a huge page pool, or -1 when not available
+*/
+static long long poolvalue(const char *dir, const char *name)
+{
+	char	path[256], buf[32];
+
+	snprintf(path, sizeof path, "%s%s", dir, name);
+
+	if (readfile(path, buf, sizeof buf) == -1)
+		return -1;
+
+	return strtoll(buf, NULL, 10);
+}
@@ -0,0 +1,173 @@
+/* intensity.c
+**
+** Measurement mode 'intensity': mixed compute/memory workload with
+** a tunable arithmetic intensity
+**
+** Usage: usemem -x intensity [-o options] [-m|-s|-S] [flags]
+**                                     virtsize [physsize]
+**
+**   The working set of physsize (default virtsize) is touched in units
+**   (cache line or page), where every touch is followed by a number of
+**   dependent arithmetic operations.  For every number of operations
+**   the throughput is shown together with the time that the same
+**   arithmetic takes without memory access, so the share of the time
+**   stalled on memory (cache and TLB misses, faults and swap-in) remains.
+**   Compare page sizes by running with -n, -t or -h, and pressure levels
+**   by running next to another usemem (or in a cgroup with memory.high).
+**
+** Options (-o):
+**   ops=list	colon-separated numbers of operations per touch
+**		(default 0:4:16:64:256:1024)
+**   unit=sz	distance between touches (default 64, cache line)
+**   random	touch units in random order instead of sequentially
+**   rounds=n	passes over the working set per measurement (default 3)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+#include "usemem.h"
+
+#define	DTLBMISS	(PERF_COUNT_HW_CACHE_DTLB | \
+			 PERF_COUNT_HW_CACHE_OP_READ << 8 | \
+			 PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+#define	LCG(x)		((x) * 6364136223846793005ULL + 1442695040888963407ULL)
+
+static volatile unsigned long long	sink;
+
+static unsigned long long	workload(char *, long long, long long, long,
+				         int, int);
+
+int
+intensitymode(struct uconf *cf)
+{
+	char			*p, *msg, *list, *s, item[16];
+	long long		size, unit, units;
+	long			ops, majflt;
+	int			rounds, random, perffd, r;
+	unsigned long long	tmem, tcpu;
+	long long		misses;
+	struct rusage		ru0, ru1;
+
+	list   = strdup(modeopt(cf, "ops") ? modeopt(cf, "ops") :
+	                                     "0:4:16:64:256:1024");
+	unit   = modeoptnum(cf, "unit",   64);
+	rounds = modeoptnum(cf, "rounds", 3);
+	random = modeopt(cf, "random") != NULL;
+	size   = cf->physical ? cf->physical : cf->virtual;
+
+	if (unit <= 0 || unit > size || rounds <= 0) {
+		fprintf(stderr, "invalid options for intensity mode\n");
+		return 1;
+	}
+
+	units = size / unit;
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	preadvise(cf, p, cf->virtual);
+	memset(p, 'X', size);
+	postadvise(cf, p, cf->virtual);
+
+	perffd = perfopen(PERF_TYPE_HW_CACHE, DTLBMISS);
+
+	printf("%lld KiB (%s) working set, %lld touches of %lld bytes apart "
+	       "(%s), %d rounds\n", size/1024, msg, units, unit,
+	       random ? "random" : "sequential", rounds);
+	printf("%7s %14s %10s %10s %8s %10s %10s %8s\n", "ops",
+	       "touches/s", "ns/touch", "cpu ns", "stall%", "MiB/s",
+	       "dTLB/touch", "majflt");
+
+	for (s = list; *s; s += strcspn(s, ":"), s += *s == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(s, ":"), s);
+
+		if ( (ops = atol(item)) < 0) {
+			fprintf(stderr, "wrong number of operations: %s\n", item);
+			return 1;
+		}
+
+		// the same loop without memory access, for the pure compute time
+		//
+		tcpu = workload(p, units, unit, ops, random, 0);
+
+		getrusage(RUSAGE_SELF, &ru0);
+		perfstart(perffd);
+
+		for (tmem=0, r=0; r < rounds; r++)
+			tmem += workload(p, units, unit, ops, random, 1);
+
+		misses = perfstop(perffd);
+		getrusage(RUSAGE_SELF, &ru1);
+
+		tmem  /= rounds;
+		majflt = ru1.ru_majflt - ru0.ru_majflt;
+
+		printf("%7ld %14.0f %10.2f %10.2f %7.1f%% %10.1f ", ops,
+		       units / (tmem / 1e9), (double)tmem / units,
+		       (double)tcpu / units,
+		       tmem > tcpu ? (tmem - tcpu) * 100.0 / tmem : 0.0,
+		       units * (double)(unit < 64 ? unit : 64) / 1048576 /
+		                (tmem / 1e9));
+
+		if (misses >= 0)
+			printf("%10.3f ", (double)misses / rounds / units);
+		else
+			printf("%10s ", "-");
+
+		printf("%8ld\n", majflt);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+/*
+** one pass: touch every unit (when access is set) followed by ops
+** dependent arithmetic operations, and return the elapsed time
+*/
+static unsigned long long workload(char *p, long long units, long long unit,
+                                   long ops, int random, int access)
+{
+	volatile char		*q = p;
+	unsigned long long	t, h = 1, x = 1;
+	long long		i, u;
+	long			o;
+
+	t = nanotime();
+
+	for (i=0; i < units; i++) {
+		if (random) {
+			x = LCG(x);
+			u = (x >> 16) % units;
+		} else {
+			u = i;
+		}
+
+		if (access)
+			h += q[u * unit];
+		else
+			h += u;
+
+		for (o=0; o < ops; o++)
+			h = LCG(h);
+	}
+
+	t = nanotime() - t;
+	sink = h;
+
+	return t;
+}
@@ -0,0 +1,479 @@
+/* kv.c
+**
+** Measurement mode 'kv': memory-bound key-value service with a
+** closed-loop load generator, to measure end-to-end request latency
+**
+** Usage: usemem -x kv [-o options] [-m|-s|-S|-F path] [flags] virtsize
+**
+**   The server holds a hash table (open addressing) and the objects in
+**   the area of virtsize, allocated according to the memory type and
+**   flags (e.g. -t for THP or -F for hugetlbfs).  It answers get and
+**   set requests on a Unix stream socket.  The load generator runs a
+**   number of client threads that each send a request, wait for the
+**   reply and send the next one (closed loop), for random keys.  The
+**   latency percentiles of gets and sets are shown.
+**
+**   By default the server is forked and the load generator runs in the
+**   usemem process itself.  With role=server or role=client both can
+**   be started separately (e.g. the server in a cgroup with memory.high
+**   or bound to a NUMA node), with the same values for objsize and
+**   objects.
+**
+** Options (-o):
+**   role=role	both, server or client (default both)
+**   socket=path	pathname of the socket (default /tmp/usemem.kv)
+**   objsize=sz	size of an object (default 1K)
+**   objects=n	number of objects (default: as many as fit in virtsize)
+**   clients=n	number of client threads (default 4)
+**   requests=n	number of requests per client (default 100000)
+**   setpct=n	percentage of set requests (default 10)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "usemem.h"
+
+#define	MAXCONN		256
+
+struct slot {			// hash table entry
+	unsigned long long	key;	// key + 1 (0: free)
+	long long		obj;	// object number
+};
+
+struct request {
+	char			op;	// 'g' = get, 's' = set
+	unsigned long long	key;
+};
+
+struct kvclient {
+	pthread_t		tid;
+	int			id;
+	long long		ngets, nsets;
+	unsigned long long	*getlat, *setlat;
+};
+
+static char		*sockpath;
+static long long	objsize, objects, requests;
+static int		setpct;
+static volatile sig_atomic_t	stop;
+
+static int		kvserver(struct uconf *, int);
+static struct slot	*lookup(struct slot *, long long, unsigned long long,
+			        int);
+static void		*kvclient(void *);
+static int		readall(int, void *, size_t);
+static int		kvconnect(void);
+static void		catchstop(int);
+
+int
+kvmode(struct uconf *cf)
+{
+	char			*role, buf[16];
+	int			nclients, i, pfd[2];
+	long long		ngets = 0, nsets = 0;
+	unsigned long long	*getlat, *setlat, t;
+	struct kvclient		*kc;
+	struct sockaddr_un	sun;
+	pid_t			pid = 0;
+
+	role     = strdup(modeopt(cf, "role") ? modeopt(cf, "role") : "both");
+	sockpath = strdup(modeopt(cf, "socket") ? modeopt(cf, "socket") :
+	                                          "/tmp/usemem.kv");
+	objsize  = modeoptnum(cf, "objsize",  1024);
+	objects  = modeoptnum(cf, "objects",  0);
+	nclients = modeoptnum(cf, "clients",  4);
+	requests = modeoptnum(cf, "requests", 100000);
+	setpct   = modeoptnum(cf, "setpct",   10);
+
+	// default number of objects: fill virtsize including
+	// a hash table with at least twice as many slots
+	//
+	if (!objects)
+		objects = cf->virtual / (objsize + 4 * sizeof(struct slot));
+
+	if (objsize <= 0 || objects <= 0 || nclients <= 0 ||
+	    nclients > MAXCONN || requests <= 0 || setpct < 0 || setpct > 100 ||
+	    strlen(sockpath) >= sizeof sun.sun_path) {
+		fprintf(stderr, "invalid options for kv mode\n");
+		return 1;
+	}
+
+	if (strcmp(role, "server") == 0)
+		return kvserver(cf, -1);
+
+	if (strcmp(role, "both") == 0) {
+		if (pipe(pfd) == -1) {
+			perror("pipe");
+			return 1;
+		}
+
+		fflush(stdout);
+
+		switch (pid = fork()) {
+		   case -1:
+			perror("fork");
+			return 1;
+
+		   case 0:
+			close(pfd[0]);
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			exit(kvserver(cf, pfd[1]));
+		}
+
+		close(pfd[1]);
+
+		if (read(pfd[0], buf, 1) != 1) {	// server ready?
+			waitpid(pid, NULL, 0);
+			return 1;
+		}
+
+		close(pfd[0]);
+	} else if (strcmp(role, "client")) {
+		fprintf(stderr, "wrong role: %s\n", role);
+		return 1;
+	}
+
+	// closed-loop load generation by client threads
+	//
+	if ( (kc = calloc(nclients, sizeof *kc)) == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	t = nanotime();
+
+	for (i=0; i < nclients; i++) {
+		kc[i].id     = i;
+		kc[i].getlat = malloc(requests * sizeof *kc[i].getlat);
+		kc[i].setlat = malloc(requests * sizeof *kc[i].setlat);
+
+		if (!kc[i].getlat || !kc[i].setlat) {
+			perror("malloc");
+			return 1;
+		}
+
+		if ( (errno = pthread_create(&kc[i].tid, NULL, kvclient, &kc[i])) ) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	for (i=0; i < nclients; i++) {
+		pthread_join(kc[i].tid, NULL);
+		ngets += kc[i].ngets;
+		nsets += kc[i].nsets;
+	}
+
+	t = nanotime() - t;
+
+	if (pid) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	// merge the latencies of all clients
+	//
+	getlat = malloc((ngets + 1) * sizeof *getlat);
+	setlat = malloc((nsets + 1) * sizeof *setlat);
+
+	if (!getlat || !setlat) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (i=0, ngets=nsets=0; i < nclients; i++) {
+		memcpy(getlat + ngets, kc[i].getlat, kc[i].ngets * sizeof *getlat);
+		memcpy(setlat + nsets, kc[i].setlat, kc[i].nsets * sizeof *setlat);
+		ngets += kc[i].ngets;
+		nsets += kc[i].nsets;
+	}
+
+	latsort(getlat, ngets);
+	latsort(setlat, nsets);
+
+	printf("%d clients, %lld requests in %.2f sec: %.0f requests/s\n",
+	       nclients, ngets + nsets, t / 1e9, (ngets + nsets) / (t / 1e9));
+	printf("%-4s %10s %10s %10s %10s %10s\n", "op", "requests",
+	       "p50 us", "p99 us", "p99.9 us", "max us");
+	printf("%-4s %10lld %10.1f %10.1f %10.1f %10.1f\n", "get", ngets,
+	       latpct(getlat, ngets, 50) / 1e3, latpct(getlat, ngets, 99) / 1e3,
+	       latpct(getlat, ngets, 99.9) / 1e3, latpct(getlat, ngets, 100) / 1e3);
+	printf("%-4s %10lld %10.1f %10.1f %10.1f %10.1f\n", "set", nsets,
+	       latpct(setlat, nsets, 50) / 1e3, latpct(setlat, nsets, 99) / 1e3,
+	       latpct(setlat, nsets, 99.9) / 1e3, latpct(setlat, nsets, 100) / 1e3);
+	fflush(stdout);
+
+	return 0;
+}
+
+/*
+** server: fill the table and serve requests until terminated
+** (readyfd is written when the socket accepts connections)
+*/
+static int kvserver(struct uconf *cf, int readyfd)
+{
+	char			*p, *msg, *objs, *buf, status;
+	long long		nslots, i;
+	struct slot		*table, *s;
+	struct request		req;
+	struct sockaddr_un	sun;
+	struct pollfd		pfds[MAXCONN+1];
+	int			lfd, nfds, n;
+	unsigned long long	t;
+
+	for (nslots=1; nslots < objects * 2; nslots *= 2)
+		;
+
+	if (nslots * sizeof *table + objects * objsize > cf->virtual) {
+		fprintf(stderr, "virtsize must be at least %lld KiB\n",
+		        (long long)(nslots * sizeof *table + objects * objsize) / 1024);
+		return 1;
+	}
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	preadvise(cf, p, cf->virtual);
+
+	table = (struct slot *)p;
+	objs  = p + nslots * sizeof *table;
+
+	if ( (buf = malloc(objsize)) == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	// fill the table with all keys
+	//
+	t = nanotime();
+
+	memset(table, 0, nslots * sizeof *table);
+
+	for (i=0; i < objects; i++) {
+		s = lookup(table, nslots, i, 1);
+		s->obj = i;
+		memset(objs + i * objsize, 'O', objsize);
+	}
+
+	postadvise(cf, p, cf->virtual);
+
+	printf("server: %lld objects of %lld bytes (%s), %lld slots, "
+	       "filled in %.2f sec, VmRSS %lld KiB\n", objects, objsize, msg,
+	       nslots, (nanotime() - t) / 1e9,
+	       procvalue("/proc/self/status", "VmRSS:"));
+	fflush(stdout);
+
+	// listen on the socket
+	//
+	memset(&sun, 0, sizeof sun);
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, sockpath);
+	unlink(sockpath);
+
+	if ( (lfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+	     bind(lfd, (struct sockaddr *)&sun, sizeof sun) == -1 ||
+	     listen(lfd, MAXCONN) == -1) {
+		perror(sockpath);
+		return 1;
+	}
+
+	signal(SIGINT,  catchstop);
+	signal(SIGTERM, catchstop);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (readyfd != -1) {
+		(void) write(readyfd, "r", 1);
+		close(readyfd);
+	}
+
+	pfds[0].fd     = lfd;
+	pfds[0].events = POLLIN;
+	nfds           = 1;
+
+	while (!stop) {
+		// do not poll the listening socket while the table is
+		// full (it would stay readable and poll would spin)
+		//
+		pfds[0].fd = nfds <= MAXCONN ? lfd : -1;
+
+		if (poll(pfds, nfds, -1) == -1)
+			continue;	// interrupted
+
+		if (pfds[0].revents & POLLIN) {
+			pfds[nfds].fd     = accept(lfd, NULL, NULL);
+			pfds[nfds].events = POLLIN;
+			pfds[nfds].revents = 0;
+
+			if (pfds[nfds].fd != -1)
+				nfds++;
+		}
+
+		for (n=1; n < nfds; n++) {
+			if (!pfds[n].revents)
+				continue;
+
+			// read the request and handle it
+			//
+			if (readall(pfds[n].fd, &req, sizeof req) == -1 ||
+			    (req.op == 's' && readall(pfds[n].fd, buf, objsize) == -1)) {
+				close(pfds[n].fd);
+				pfds[n--] = pfds[--nfds];
+				continue;
+			}
+
+			s      = lookup(table, nslots, req.key, 0);
+			status = s ? 'y' : 'n';
+
+			if (s && req.op == 's')
+				memcpy(objs + s->obj * objsize, buf, objsize);
+
+			if (write(pfds[n].fd, &status, 1) != 1 ||
+			    (s && req.op == 'g' &&
+			     write(pfds[n].fd, objs + s->obj * objsize, objsize) !=
+			                                                 objsize)) {
+				close(pfds[n].fd);
+				pfds[n--] = pfds[--nfds];
+			}
+		}
+	}
+
+	unlink(sockpath);
+
+	return 0;
+}
+
+/*
+** find the slot of a key in the hash table (linear probing),
+** or a free slot to insert it
+*/
+static struct slot *lookup(struct slot *table, long long nslots,
+                           unsigned long long key, int insert)
+{
+	unsigned long long	h = (key + 1) * 0x9E3779B97F4A7C15ULL;
+	long long		i;
+
+	for (i = h >> 20 & (nslots - 1); ; i = (i + 1) & (nslots - 1)) {
+		if (table[i].key == key + 1)
+			return &table[i];
+
+		if (table[i].key == 0) {
+			if (!insert)
+				return NULL;
+
+			table[i].key = key + 1;
+			return &table[i];
+		}
+	}
+}
+
+/*
+** client thread: closed loop of requests for random keys
+*/
+static void *kvclient(void *arg)
+{
+	struct kvclient		*kc = arg;
+	struct request		req;
+	unsigned long long	rnd = kc->id * 2654435761ULL + 1, t;
+	char			*buf, status;
+	long long		r;
+	int			fd;
+
+	if ( (buf = malloc(objsize)) == NULL || (fd = kvconnect()) == -1)
+		return NULL;
+
+	memset(buf, 'C', objsize);
+	memset(&req, 0, sizeof req);
+
+	for (r=0; r < requests; r++) {
+		rnd     = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+		req.key = (rnd >> 16) % objects;
+		req.op  = (long)((rnd >> 8) % 100) < setpct ? 's' : 'g';
+
+		t = nanotime();
+
+		if (write(fd, &req, sizeof req) != sizeof req ||
+		    (req.op == 's' && write(fd, buf, objsize) != objsize) ||
+		    readall(fd, &status, 1) == -1 ||
+		    (req.op == 'g' && status == 'y' &&
+		     readall(fd, buf, objsize) == -1)) {
+			fprintf(stderr, "client %d: connection lost\n", kc->id);
+			break;
+		}
+
+		t = nanotime() - t;
+
+		if (req.op == 'g')
+			kc->getlat[kc->ngets++] = t;
+		else
+			kc->setlat[kc->nsets++] = t;
+	}
+
+	close(fd);
+	free(buf);
+
+	return NULL;
+}
+
+/*
+** connect to the server socket
+*/
+static int kvconnect(void)
+{
+	struct sockaddr_un	sun;
+	int			fd;
+
+	memset(&sun, 0, sizeof sun);
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, sockpath);
+
+	if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+	     connect(fd, (struct sockaddr *)&sun, sizeof sun) == -1) {
+		perror(sockpath);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+** read exactly len bytes, returns -1 on failure or end of file
+*/
+static int readall(int fd, void *buf, size_t len)
+{
+	ssize_t	n;
+
+	while (len) {
+		if ( (n = read(fd, buf, len)) <= 0)
+			return -1;
+
+		buf  = (char *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void catchstop(int sig)
+{
+	stop = 1;
+}
@@ -0,0 +1,228 @@
+/* leak.c
+**
+** Leak projection for repeat mode (flag -L with -r)
+**
+** After every repeated allocation the growth rate of the process
+** (resident + swapped) is estimated by a linear least-squares fit over
+** all samples so far.  From the headroom that is left, the time until
+** the following events is projected:
+**
+**	high	memory.current of the own cgroup reaches memory.high
+**	max	memory.current of the own cgroup reaches memory.max
+**	swap	SwapFree drops to zero (system-wide)
+**	oom	MemAvailable + SwapFree is exhausted, or the memory.max
+**		plus the remaining swap of the own cgroup is exhausted
+**
+** When an event actually happens (detected via memory.events of the
+** cgroup, /proc/meminfo and the oom_kill counter of /proc/vmstat), the
+** real elapsed time is shown next to the first and the most recent
+** projection for that event.
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <limits.h>
+
+#include "usemem.h"
+
+#define	NEVENTS	4
+
+static struct leakevent {
+	char	*name;
+	double	first;		// first projection (seconds since start)
+	double	last;		// latest projection (seconds since start)
+	char	happened;
+} events[NEVENTS] = {
+	{ "memory.high" },
+	{ "memory.max"  },
+	{ "swap"        },
+	{ "oom"         },
+};
+
+enum { EV_HIGH, EV_MAX, EV_SWAP, EV_OOM };
+
+// running sums for the least-squares fit of usage (bytes) over time
+//
+static double			n, st, sy, stt, sty;
+static unsigned long long	starttime;
+static long long		high0, max0, oom0;
+
+static long long		eventcount(const char *);
+static void			projectevent(int, double, double);
+static void			checkevent(int, int, double);
+
+/*
+** remember the state before the first allocation
+*/
+void
+leakinit(void)
+{
+	starttime = nanotime();
+	high0     = eventcount("high");
+	max0      = eventcount("max");
+	oom0      = procvalue("/proc/vmstat", "oom_kill");
+}
+
+/*
+** register a new sample after an allocation and show the projection
+*/
+void
+leaksample(void)
+{
+	double		t, y, rate, avail, swapfree, current, high, max,
+			cgswap, headroom;
+	long long	v;
+
+	t = (nanotime() - starttime) / 1e9;
+	y = (procvalue("/proc/self/status", "VmRSS:") +
+	     procvalue("/proc/self/status", "VmSwap:")) * 1024.0;
+
+	n++;
+	st  += t;
+	sy  += y;
+	stt += t * t;
+	sty += t * y;
+
+	// check events that happened since the previous sample
+	//
+	v = eventcount("high");
+	checkevent(EV_HIGH, high0 >= 0 && v > high0, t);
+
+	v = eventcount("max");
+	checkevent(EV_MAX, max0 >= 0 && v > max0, t);
+
+	avail    = procvalue("/proc/meminfo", "MemAvailable:") * 1024.0;
+	swapfree = procvalue("/proc/meminfo", "SwapFree:") * 1024.0;
+
+	checkevent(EV_SWAP, procvalue("/proc/meminfo", "SwapTotal:") > 0 &&
+	                    swapfree == 0, t);
+
+	v = procvalue("/proc/vmstat", "oom_kill");
+	checkevent(EV_OOM, oom0 >= 0 && v > oom0, t);
+
+	// growth rate in bytes per second
+	//
+	if (n < 2 || n * stt - st * st <= 0) {
+		printf("    projection: awaiting next sample\n");
+		return;
+	}
+
+	rate = (n * sty - st * sy) / (n * stt - st * st);
+
+	printf("    projection: growth %.0f KiB/s,", rate / 1024);
+
+	if (rate <= 0) {
+		printf(" no growth\n");
+		return;
+	}
+
+	current = cgroupvalue("memory.current");
+	high    = cgroupvalue("memory.high");
+	max     = cgroupvalue("memory.max");
+
+	// swap left for the own cgroup
+	//
+	cgswap  = cgroupvalue("swap.max");
+
+	if (cgswap >= 0 && cgswap != LLONG_MAX) {
+		cgswap -= cgroupvalue("swap.current");
+
+		if (cgswap > swapfree)
+			cgswap = swapfree;
+	} else {
+		cgswap = swapfree;
+	}
+
+	if (cgswap < 0)
+		cgswap = 0;
+
+	projectevent(EV_HIGH, t, current < 0 || high == LLONG_MAX ?
+	                         -1 : (high - current) / rate);
+
+	projectevent(EV_MAX,  t, current < 0 || max == LLONG_MAX ?
+	                         -1 : (max - current) / rate);
+
+	// swapping is assumed to start when available memory is exhausted
+	//
+	projectevent(EV_SWAP, t, swapfree <= 0 ?
+	                         -1 : (avail + swapfree) / rate);
+
+	headroom = avail + swapfree;
+
+	if (current >= 0 && max != LLONG_MAX && max - current + cgswap < headroom)
+		headroom = max - current + cgswap;
+
+	projectevent(EV_OOM, t, headroom / rate);
+
+	printf("\n");
+}
+
+/*
+** show and register the projected number of seconds until an event
+** (negative: not applicable)
+*/
+static void projectevent(int ev, double t, double secs)
+{
+	if (events[ev].happened)
+		return;
+
+	if (secs < 0) {
+		printf(" %s -", events[ev].name);
+		return;
+	}
+
+	if (secs < 0.5)
+		secs = 0;
+
+	printf(" %s %.0fs", events[ev].name, secs);
+
+	if (!events[ev].first)
+		events[ev].first = t + secs;
+
+	events[ev].last = t + secs;
+}
+
+/*
+** report an event that happened at (about) time t, compared to
+** the projections made earlier
+*/
+static void checkevent(int ev, int happened, double t)
+{
+	struct leakevent	*e = &events[ev];
+
+	if (!happened || e->happened || t <= 0)
+		return;
+
+	e->happened = 1;
+
+	printf("    event: %s reached after %.0fs", e->name, t);
+
+	if (e->first)
+		printf(" (projected %.0fs initially: %+.1f%%, "
+		       "%.0fs recently: %+.1f%%)",
+		       e->first, (e->first - t) * 100 / t,
+		       e->last,  (e->last  - t) * 100 / t);
+	else
+		printf(" (not projected)");
+
+	printf("\n");
+}
+
+/*
+** obtain a counter from memory.events of the own cgroup
+*/
+static long long eventcount(const char *name)
+{
+	char	path[PATH_MAX];
+
+	if (cgroupfile(path, sizeof path, "memory.events") == -1)
+		return -1;
+
+	return procvalue(path, name);
+}
@@ -0,0 +1,270 @@
+/* memhigh.c
+**
+** Measurement mode 'memhigh': penalty curve of the allocation
+** throttling when the working set exceeds memory.high of the cgroup
+**
+** Usage: usemem -x memhigh [-o options] [-m|-s|-S] [flags]
+**                                     virtsize [highsize]
+**
+**   The working set is grown in steps from below to above memory.high.
+**   In each step, the working set is referenced a number of rounds and
+**   the wall time, CPU time, page faults, memory.events 'high' count and
+**   memory stall time (memory.pressure) are measured.  The time off-CPU
+**   per page fault shows the throttling delay.
+**
+**   virtsize	memory area, must contain the largest working set
+**   highsize	value for memory.high (default: current memory.high)
+**
+** Options (-o):
+**   cgroup=path	parent cgroup (delegated subtree) in which a cgroup is
+**		created for the measurement (default: the own cgroup, of
+**		which memory.high is restored afterwards, also when
+**		interrupted by SIGINT or SIGTERM)
+**   step=sz	working set increment per step (default 1% of memory.high)
+**   below=n	number of steps below memory.high to start (default 2)
+**   steps=n	number of steps above memory.high (default 10)
+**   rounds=n	number of rounds to reference per step (default 3)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "usemem.h"
+
+static char		highpath[PATH_MAX+32], orghigh[32];
+
+static long long	stalltime(const char *);
+static void		restorehigh(int);
+static void		highsteps(struct uconf *, const char *, long long,
+			          long long, int, int, int);
+
+int
+memhighmode(struct uconf *cf)
+{
+	char		parent[PATH_MAX], cgdir[PATH_MAX], path[PATH_MAX+32],
+			name[32];
+	long long	high, step;
+	int		below, steps, rounds;
+	pid_t		pid;
+
+	below  = modeoptnum(cf, "below",  2);
+	steps  = modeoptnum(cf, "steps",  10);
+	rounds = modeoptnum(cf, "rounds", 3);
+
+	if (below < 0 || steps <= 0 || rounds <= 0) {
+		fprintf(stderr, "invalid options for memhigh mode\n");
+		return 1;
+	}
+
+	if (cgroupfile(cgdir, sizeof cgdir, "") == -1) {
+		fprintf(stderr, "no cgroup version 2 hierarchy mounted\n");
+		return 1;
+	}
+
+	cgdir[strlen(cgdir)-1] = 0;	// strip trailing slash
+
+	// determine the value for memory.high
+	//
+	if (cf->physical) {
+		high = cf->physical;
+	} else if ( (high = cgroupvalue("memory.high")) <= 0 || high == LLONG_MAX) {
+		fprintf(stderr, "memory.high not set for own cgroup: "
+		                "specify highsize\n");
+		return 1;
+	}
+
+	step = modeoptnum(cf, "step", high / 100);
+
+	if (step <= 0 || step * below > high) {
+		fprintf(stderr, "invalid step size\n");
+		return 1;
+	}
+
+	if (high + steps * step > cf->virtual) {
+		fprintf(stderr, "virtsize must be at least %lld KiB\n",
+		                (high + steps * step) / 1024);
+		return 1;
+	}
+
+	// measure in the own cgroup
+	//
+	if (!modeopt(cf, "cgroup")) {
+		snprintf(highpath, sizeof highpath, "%s/memory.high", cgdir);
+
+		if (readfile(highpath, orghigh, sizeof orghigh) == -1) {
+			perror(highpath);
+			return 1;
+		}
+
+		signal(SIGINT,  restorehigh);
+		signal(SIGTERM, restorehigh);
+
+		if (writefile(highpath, "%lld", high) == -1) {
+			perror(highpath);
+			return 1;
+		}
+
+		highsteps(cf, cgdir, high, step, below, steps, rounds);
+
+		(void) writefile(highpath, "%s", orghigh);
+		return 0;
+	}
+
+	// measure in a separate cgroup by a child process
+	//
+	snprintf(parent, sizeof parent, "%s", modeopt(cf, "cgroup"));
+	snprintf(name, sizeof name, "usemem.%d", getpid());
+
+	if (cgcreate(parent, name, cgdir, sizeof cgdir) == -1)
+		return 1;
+
+	snprintf(path, sizeof path, "%s/memory.high", cgdir);
+
+	if (writefile(path, "%lld", high) == -1) {
+		perror(path);
+		rmdir(cgdir);
+		return 1;
+	}
+
+	switch (pid = fork()) {
+	   case -1:
+		perror("fork");
+		rmdir(cgdir);
+		return 1;
+
+	   case 0:
+		snprintf(path, sizeof path, "%s/cgroup.procs", cgdir);
+
+		if (writefile(path, "%d", getpid()) == -1) {
+			perror(path);
+			exit(1);
+		}
+
+		highsteps(cf, cgdir, high, step, below, steps, rounds);
+		exit(0);
+	}
+
+	waitpid(pid, NULL, 0);
+	rmdir(cgdir);
+
+	return 0;
+}
+
+/*
+** grow the working set in steps and measure the penalty per step
+*/
+static void highsteps(struct uconf *cf, const char *cgdir, long long high,
+                      long long step, int below, int steps, int rounds)
+{
+	char			events[PATH_MAX+32], pressure[PATH_MAX+32], *p, *msg;
+	long long		ws, high0, stall0, faults;
+	double			wall, cpu;
+	struct rusage		ru0, ru1;
+	unsigned long long	t;
+	int			i, r;
+
+	snprintf(events,   sizeof events,   "%s/memory.events", cgdir);
+	snprintf(pressure, sizeof pressure, "%s/memory.pressure", cgdir);
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		exit(1);
+	}
+
+	preadvise(cf, p, cf->virtual);
+
+	printf("memory.high %lld KiB, step %lld KiB\n", high/1024, step/1024);
+	printf("%12s %12s %10s %10s %10s %10s %8s %12s\n", "ws KiB",
+	       "over KiB", "wall ms", "cpu ms", "faults", "stall ms",
+	       "high ev", "offcpu/flt");
+
+	for (i = -below; i <= steps; i++) {
+		ws     = high + i * step;
+		high0  = procvalue(events, "high");
+		stall0 = stalltime(pressure);
+
+		getrusage(RUSAGE_SELF, &ru0);
+		t = nanotime();
+
+		for (r=0; r < rounds; r++)
+			memset(p, 'X', ws);
+
+		wall = (nanotime() - t) / 1e9;
+		getrusage(RUSAGE_SELF, &ru1);
+
+		cpu    = ru1.ru_utime.tv_sec  - ru0.ru_utime.tv_sec  +
+		         ru1.ru_stime.tv_sec  - ru0.ru_stime.tv_sec  +
+		        (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec +
+		         ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+		faults = ru1.ru_minflt - ru0.ru_minflt +
+		         ru1.ru_majflt - ru0.ru_majflt;
+
+		printf("%12lld %12lld %10.1f %10.1f %10lld %10.1f %8lld ",
+		       ws/1024, ws > high ? (ws - high)/1024 : 0,
+		       wall * 1e3, cpu * 1e3, faults,
+		       (stalltime(pressure) - stall0) / 1e3,
+		       procvalue(events, "high") - high0);
+
+		if (faults && wall > cpu)
+			printf("%10.1fus\n", (wall - cpu) * 1e6 / faults);
+		else
+			printf("%12s\n", "-");
+
+		fflush(stdout);
+	}
+}
+
+/*
+** obtain the total stall time in microseconds of the 'some'
+** line of a pressure file (PSI), or -1 when not available
+*/
+static long long stalltime(const char *path)
+{
+	FILE		*fp;
+	char		line[256], *s;
+	long long	total = -1;
+
+	if ( (fp = fopen(path, "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof line, fp)) {
+		if (strncmp(line, "some", 4) == 0 &&
+		    (s = strstr(line, "total=")) ) {
+			total = strtoll(s+6, NULL, 10);
+			break;
+		}
+	}
+
+	fclose(fp);
+	return total;
+}
+
+/*
+** signal handler: restore memory.high of the own cgroup
+** (only async-signal-safe calls)
+*/
+static void restorehigh(int sig)
+{
+	int	fd;
+
+	if ( (fd = open(highpath, O_WRONLY)) != -1) {
+		(void) write(fd, orghigh, strlen(orghigh));
+		close(fd);
+	}
+
+	_exit(1);
+}
@@ -0,0 +1,297 @@
+/* numabal.c
+**
+** Measurement mode 'numabal': convergence of automatic NUMA balancing
+** after the threads that access a memory area move to another node
+**
+** Usage: usemem -x numabal [-o options] [-m|-s|-S] [flags] virtsize
+**
+**   The area of virtsize is referenced by threads that run on the CPUs
+**   of the 'from' node, so (first touch) it is allocated on that node.
+**   The threads keep accessing random cache lines of the area and after
+**   the switch time they are bound to the CPUs of the 'to' node.  From
+**   then on NUMA balancing (when kernel.numa_balancing is enabled) should
+**   migrate the pages to the new node.  Every interval the access
+**   latency, the NUMA hinting faults (total and local) and migrated
+**   pages of /proc/vmstat, and the pages of the area per online node
+**   (sampled with move_pages(2), see stats.c) are shown.  The online
+**   nodes are obtained from /sys/devices/system/node/online.
+**
+**   Emulated NUMA nodes (numa=fake=N) appear in sysfs like real nodes,
+**   so the mode should run on such a test VM as long as both nodes have
+**   CPUs (a node without CPUs is refused).  Limitation: this has not
+**   been verified on a numa=fake guest yet, and emulated nodes share
+**   the same memory, so there only the hinting faults and migrations
+**   are meaningful, not the access latency.
+**
+** Options (-o):
+**   threads=n	number of accessing threads (default 1)
+**   from=node	node to start on (default 0)
+**   to=node	node to move to (default 1)
+**   switch=sec	time after which the threads move (default 10)
+**   duration=sec	duration of the run (default 60)
+**   interval=sec	report interval (default 1)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "usemem.h"
+
+#define	MAXNODES	64
+
+struct accessor {
+	pthread_t		tid;
+	int			id;
+	volatile long long	accesses;
+};
+
+static char		*area;
+static long long	lines;
+static volatile int	node = -1, stop;
+static cpu_set_t	nodeset[2];	// CPUs of 'from' and 'to' node
+static char		online[MAXNODES];
+
+static int		nodecpus(int, cpu_set_t *);
+static void		*accessor(void *);
+static int		nodesonline(void);
+
+int
+numabalmode(struct uconf *cf)
+{
+	char			*msg, buf[16];
+	int			threads, from, to, swtime, duration, interval,
+				i, n, nnodes;
+	long long		pages[MAXNODES], total, accesses, prev,
+				hint, hintlocal, migrated;
+	unsigned long long	start, t, last;
+	struct accessor		*acc;
+
+	threads  = modeoptnum(cf, "threads",  1);
+	from     = modeoptnum(cf, "from",     0);
+	to       = modeoptnum(cf, "to",       1);
+	swtime   = modeoptnum(cf, "switch",   10);
+	duration = modeoptnum(cf, "duration", 60);
+	interval = modeoptnum(cf, "interval", 1);
+
+	if (threads <= 0 || from == to || from < 0 || from >= MAXNODES ||
+	    to < 0 || to >= MAXNODES || swtime < 0 || duration <= 0 ||
+	    interval <= 0 || cf->virtual < 64) {
+		fprintf(stderr, "invalid options for numabal mode\n");
+		return 1;
+	}
+
+	if (nodecpus(from, &nodeset[0]) == -1 || nodecpus(to, &nodeset[1]) == -1) {
+		fprintf(stderr, "node %d or %d not available (or without CPUs)\n",
+		        from, to);
+		return 1;
+	}
+
+	if (readfile("/proc/sys/kernel/numa_balancing", buf, sizeof buf) == -1)
+		snprintf(buf, sizeof buf, "?");
+
+	if ( (area = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	lines = cf->virtual / 64;
+
+	// reference the area from the first node
+	//
+	if (sched_setaffinity(0, sizeof nodeset[0], &nodeset[0]) == -1) {
+		perror("sched_setaffinity");
+		return 1;
+	}
+
+	preadvise(cf, area, cf->virtual);
+	memset(area, 'X', cf->virtual);
+	postadvise(cf, area, cf->virtual);
+
+	printf("%lld KiB (%s) on node %d, %d threads move to node %d after "
+	       "%d sec, kernel.numa_balancing = %s\n", cf->virtual/1024, msg,
+	       from, threads, to, swtime, buf);
+	printf("%5s %4s %10s %10s %10s %10s %8s", "sec", "node", "ns/access",
+	       "hintflt", "local", "migrated", "on node");
+
+	nnodes = nodesonline();
+
+	for (n=0; n < nnodes; n++)
+		if (online[n])
+			printf("  N%-7d", n);
+
+	printf("\n");
+	fflush(stdout);
+
+	if ( (acc = calloc(threads, sizeof *acc)) == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	node = 0;
+
+	for (i=0; i < threads; i++) {
+		acc[i].id = i;
+
+		if ( (errno = pthread_create(&acc[i].tid, NULL, accessor, &acc[i])) ) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	start     = last = nanotime();
+	prev      = 0;
+	hint      = procvalue("/proc/vmstat", "numa_hint_faults");
+	hintlocal = procvalue("/proc/vmstat", "numa_hint_faults_local");
+	migrated  = procvalue("/proc/vmstat", "numa_pages_migrated");
+
+	while ((t = nanotime()) - start < duration * 1000000000ULL) {
+		sleep(interval);
+
+		if (node == 0 && nanotime() - start >= swtime * 1000000000ULL)
+			node = 1;	// threads move at their next access batch
+
+		t = nanotime();
+
+		for (i=0, accesses=0; i < threads; i++)
+			accesses += acc[i].accesses;
+
+		nodestat(area, cf->virtual, STATPAGES, pages, MAXNODES);
+
+		for (n=0, total=0; n < nnodes; n++)
+			total += pages[n];
+
+		printf("%5llu %4d %10.1f %10lld %10lld %10lld %7.1f%%",
+		       (t - start) / 1000000000ULL, node ? to : from,
+		       accesses > prev ?
+		           (double)(t - last) * threads / (accesses - prev) : 0,
+		       procvalue("/proc/vmstat", "numa_hint_faults") - hint,
+		       procvalue("/proc/vmstat", "numa_hint_faults_local") - hintlocal,
+		       procvalue("/proc/vmstat", "numa_pages_migrated") - migrated,
+		       total ? pages[node ? to : from] * 100.0 / total : 0);
+
+		for (n=0; n < nnodes; n++)
+			if (online[n])
+				printf("  %-8lld", pages[n]);
+
+		printf("\n");
+		fflush(stdout);
+
+		hint      = procvalue("/proc/vmstat", "numa_hint_faults");
+		hintlocal = procvalue("/proc/vmstat", "numa_hint_faults_local");
+		migrated  = procvalue("/proc/vmstat", "numa_pages_migrated");
+		prev      = accesses;
+		last      = t;
+	}
+
+	stop = 1;
+
+	for (i=0; i < threads; i++)
+		pthread_join(acc[i].tid, NULL);
+
+	return 0;
+}
+
+/*
+** thread: access random cache lines of the area, bound
+** to the CPUs of the current node
+*/
+static void *accessor(void *arg)
+{
+	struct accessor		*acc = arg;
+	unsigned long long	rnd = acc->id * 2654435761ULL + 1, sum = 0;
+	int			bound = -1, i;
+
+	while (!stop) {
+		if (bound != node) {
+			bound = node;
+			(void) sched_setaffinity(0, sizeof nodeset[bound],
+			                         &nodeset[bound]);
+		}
+
+		for (i=0; i < 4096; i++) {
+			rnd  = rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+			sum += ((volatile char *)area)[((rnd >> 16) % lines) * 64];
+		}
+
+		acc->accesses += i;
+	}
+
+	return (void *)sum;
+}
+
+/*
+** obtain the CPUs of a node from sysfs (list like "0-3,8-11")
+** returns -1 when the node does not exist or has no CPUs
+*/
+static int nodecpus(int nodenr, cpu_set_t *set)
+{
+	char	path[128], list[1024], *s;
+	int	lo, hi, n = 0;
+
+	snprintf(path, sizeof path,
+	         "/sys/devices/system/node/node%d/cpulist", nodenr);
+
+	if (readfile(path, list, sizeof list) == -1)
+		return -1;
+
+	CPU_ZERO(set);
+
+	for (s = list; *s; s += strcspn(s, ","), s += *s == ',') {
+		lo = hi = strtol(s, NULL, 10);
+
+		if (s[strcspn(s, "-,")] == '-')
+			hi = strtol(s + strcspn(s, "-") + 1, NULL, 10);
+
+		for (; lo <= hi; lo++, n++)
+			CPU_SET(lo, set);
+	}
+
+	return n ? 0 : -1;
+}
+
+/*
+** mark the online nodes from sysfs (list like "0-1,3"); without
+** this file (kernel without NUMA) only node 0 is assumed
+** returns the highest online node plus one
+*/
+static int nodesonline(void)
+{
+	char	list[1024], *s;
+	int	lo, hi, n = 1;
+
+	memset(online, 0, sizeof online);
+
+	if (readfile("/sys/devices/system/node/online", list, sizeof list) == -1) {
+		online[0] = 1;
+		return 1;
+	}
+
+	for (s = list; *s; s += strcspn(s, ","), s += *s == ',') {
+		lo = hi = strtol(s, NULL, 10);
+
+		if (s[strcspn(s, "-,")] == '-')
+			hi = strtol(s + strcspn(s, "-") + 1, NULL, 10);
+
+		for (; lo <= hi && lo < MAXNODES; lo++) {
+			online[lo] = 1;
+
+			if (lo >= n)
+				n = lo + 1;
+		}
+	}
+
+	return n;
+}
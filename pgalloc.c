@@ -0,0 +1,280 @@
+/* pgalloc.c
+**
+** Measurement mode 'pgalloc': scalability of the page allocator
+** with an increasing number of threads
+**
+** Usage: usemem -x pgalloc [-o options] [-t|-n] chunksize
+**
+**   Every thread runs tight cycles on a private chunk (e.g. 64K to 2M):
+**   mmap, populate by a store in every page and munmap (op=munmap), or
+**   populate and release by MADV_DONTNEED of a chunk that stays mapped
+**   (op=dontneed).  Both return the pages to the per-CPU page lists and
+**   from there to the zone free lists, so this stresses the allocator
+**   rather than the page copy of one big memset.  For every number of
+**   threads the total number of pages allocated per second, the
+**   scaling efficiency per thread relative to the first number of
+**   threads in the list (one thread by default), and the cycle
+**   latency percentiles are shown.  With flag -t every chunk is
+**   aligned on a huge page boundary, so it can get a THP.
+**
+**   chunksize	size of the chunk per cycle (virtsize)
+**
+** Options (-o):
+**   threads=list	colon-separated numbers of threads (default 1:2:4:...
+**		up to the number of CPUs)
+**   op=op	munmap or dontneed (default munmap)
+**   duration=sec	duration per number of threads (default 5)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "usemem.h"
+
+#ifndef	MADV_HUGEPAGE
+#define	MADV_HUGEPAGE	0	// ignore if not supported
+#endif
+
+#ifndef	MADV_NOHUGEPAGE
+#define	MADV_NOHUGEPAGE	0	// ignore if not supported
+#endif
+
+#define	MAXSAMPLES	(256*1024)	// latency samples per thread
+
+struct cycler {
+	pthread_t		tid;
+	struct uconf		*cf;
+	long long		cycles;
+	long			nlat;
+	unsigned long long	*lat, end;
+};
+
+static int			dontneed, advice, align;
+static volatile int		stop;
+static pthread_barrier_t	barrier;
+
+static void		*cycler(void *);
+static char		*mapchunk(long long);
+
+int
+pgallocmode(struct uconf *cf)
+{
+	char			*list, *t, item[16], deflist[128];
+	int			duration, nthreads, ncpus, i, n;
+	long long		cycles, pages;
+	long			nlat;
+	double			rate, rate1 = 0;
+	unsigned long long	start, elapsed, *lat;
+	struct cycler		*cy;
+
+	ncpus    = sysconf(_SC_NPROCESSORS_ONLN);
+	duration = modeoptnum(cf, "duration", 5);
+	dontneed = modeopt(cf, "op") && strcmp(modeopt(cf, "op"), "dontneed") == 0;
+
+	if (modeopt(cf, "op") && !dontneed && strcmp(modeopt(cf, "op"), "munmap")) {
+		fprintf(stderr, "wrong op: %s\n", modeopt(cf, "op"));
+		return 1;
+	}
+
+	if (duration <= 0 || cf->virtual < cf->pagesize) {
+		fprintf(stderr, "invalid options for pgalloc mode\n");
+		return 1;
+	}
+
+	// with op=munmap every cycle maps a new chunk, so only the THP
+	// advice can be applied (per chunk, outside the timed cycle)
+	//
+	if (!dontneed) {
+		advice = cf->tflag ? MADV_HUGEPAGE : cf->nflag ? MADV_NOHUGEPAGE : 0;
+
+		if ((cf->tflag || cf->nflag) && advice == 0)
+			fprintf(stderr, "warning: advise %s not supported "
+			                "(ignored)\n", cf->tflag ? "-t" : "-n");
+
+		if (cf->lflag || cf->Mflag)
+			fprintf(stderr, "warning: -l and -M flags ignored "
+			                "with op=munmap\n");
+	}
+
+	// default list of numbers of threads: powers of 2 up to #CPUs
+	//
+	for (n=1, deflist[0]=0; ; n *= 2) {
+		if (n > ncpus)
+			n = ncpus;
+
+		snprintf(deflist + strlen(deflist), sizeof deflist -
+		         strlen(deflist), "%s%d", n > 1 ? ":" : "", n);
+
+		if (n == ncpus)
+			break;
+	}
+
+	list = strdup(modeopt(cf, "threads") ? modeopt(cf, "threads") : deflist);
+
+	align = cf->tflag;
+
+	printf("chunk %lld KiB (%lld pages), op %s, %d sec per step, %d CPUs, "
+	       "scaling relative to %d thread(s)\n", cf->virtual/1024,
+	       cf->virtual/cf->pagesize, dontneed ? "dontneed" : "munmap",
+	       duration, ncpus, atoi(list));
+	printf("%7s %14s %14s %8s %10s %10s %10s %10s\n", "threads",
+	       "pages/s", "per thread", "scaling", "p50 us", "p99 us",
+	       "p99.9 us", "max us");
+
+	for (t = list; *t; t += strcspn(t, ":"), t += *t == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(t, ":"), t);
+
+		if ( (nthreads = atoi(item)) <= 0) {
+			fprintf(stderr, "wrong number of threads: %s\n", item);
+			return 1;
+		}
+
+		if ( (cy = calloc(nthreads, sizeof *cy)) == NULL ||
+		     (lat = malloc(nthreads * MAXSAMPLES * sizeof *lat)) == NULL) {
+			perror("malloc");
+			return 1;
+		}
+
+		pthread_barrier_init(&barrier, NULL, nthreads + 1);
+		stop = 0;
+
+		for (i=0; i < nthreads; i++) {
+			cy[i].cf  = cf;
+			cy[i].lat = lat + (long)i * MAXSAMPLES;
+
+			if ( (errno = pthread_create(&cy[i].tid, NULL, cycler,
+			                             &cy[i])) ) {
+				perror("pthread_create");
+				return 1;
+			}
+		}
+
+		// start all threads at once and stop them after duration;
+		// the step ends when the last thread finished its last cycle
+		//
+		pthread_barrier_wait(&barrier);
+		start = nanotime();
+		sleep(duration);
+		stop = 1;
+
+		for (i=0, cycles=0, nlat=0, elapsed=0; i < nthreads; i++) {
+			pthread_join(cy[i].tid, NULL);
+			cycles += cy[i].cycles;
+
+			if (cy[i].end - start > elapsed)
+				elapsed = cy[i].end - start;
+
+			memmove(lat + nlat, cy[i].lat, cy[i].nlat * sizeof *lat);
+			nlat   += cy[i].nlat;
+		}
+
+		pages   = cycles * (cf->virtual / cf->pagesize);
+		rate    = pages / (elapsed / 1e9);
+
+		if (!rate1)
+			rate1 = rate / nthreads;
+
+		latsort(lat, nlat);
+
+		printf("%7d %14.0f %14.0f %7.0f%% %10.1f %10.1f %10.1f %10.1f\n",
+		       nthreads, rate, rate / nthreads,
+		       rate / nthreads / rate1 * 100,
+		       latpct(lat, nlat, 50) / 1e3, latpct(lat, nlat, 99) / 1e3,
+		       latpct(lat, nlat, 99.9) / 1e3, latpct(lat, nlat, 100) / 1e3);
+		fflush(stdout);
+
+		pthread_barrier_destroy(&barrier);
+		free(lat);
+		free(cy);
+	}
+
+	return 0;
+}
+
+/*
+** thread: allocate, populate and release the chunk until stopped
+** (latencies are kept cyclically for the last MAXSAMPLES cycles)
+*/
+static void *cycler(void *arg)
+{
+	struct cycler		*cy = arg;
+	struct uconf		*cf = cy->cf;
+	long long		size = cf->virtual, off;
+	unsigned long long	t, tadv;
+	char			*p = NULL;
+
+	if (dontneed) {
+		if ( (p = mapchunk(size)) == NULL) {
+			perror("mmap");
+			exit(1);
+		}
+
+		preadvise(cf, p, size);
+	}
+
+	pthread_barrier_wait(&barrier);
+
+	while (!stop) {
+		t = nanotime();
+
+		if (!dontneed) {
+			if ( (p = mapchunk(size)) == NULL) {
+				perror("mmap");
+				exit(1);
+			}
+
+			if (advice) {
+				tadv = nanotime();
+				(void) madvise(p, size, advice);
+				t   += nanotime() - tadv;
+			}
+		}
+
+		for (off=0; off < size; off += cf->pagesize)
+			p[off] = 'X';
+
+		if (dontneed)
+			(void) madvise(p, size, MADV_DONTNEED);
+		else
+			(void) munmap(p, size);
+
+		cy->lat[cy->cycles++ % MAXSAMPLES] = nanotime() - t;
+	}
+
+	cy->end  = nanotime();
+	cy->nlat = cy->cycles < MAXSAMPLES ? cy->cycles : MAXSAMPLES;
+
+	if (dontneed)
+		(void) munmap(p, size);
+
+	return NULL;
+}
+
+/*
+** map a chunk, aligned on a huge page boundary with flag -t
+** returns NULL on failure
+*/
+static char *mapchunk(long long size)
+{
+	char	*p;
+
+	if (align)
+		return mapaligned(size, HPAGESIZE);
+
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+	         MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
@@ -0,0 +1,265 @@
+/* pollute.c
+**
+** Measurement mode 'pollute': noisy neighbor that evicts the cache
+** lines of co-running processes at a controlled rate
+**
+** Usage: usemem -x pollute [-o options] [-m|-s|-S] [flags]
+**                                     virtsize [physsize]
+**
+**   The alive set is sized relative to the L2 cache or the last level
+**   cache (LLC) of the CPU, as found in /sys/devices/system/cpu/cpuN/cache,
+**   and is swept continuously with the given stride.  Every access
+**   touches another cache line, so the number of lines touched per second
+**   is the rate at which lines of other processes sharing that cache are
+**   evicted (when the alive set exceeds the cache).  The slowdown of the
+**   co-runner itself should be measured by the co-runner.
+**
+**   virtsize	memory area, must contain the alive set
+**   physsize	alive set (default: derived from the cache size, see 'pct')
+**
+** Options (-o):
+**   cache=lvl	L2 or LLC (default LLC)
+**   pct=n	alive set as percentage of the cache size (default 200)
+**   stride=sz	distance between accesses, at least the cache line size
+**		(default: cache line size)
+**   rate=n	cache lines touched per second (default 0: unlimited)
+**   write	store into the lines instead of loading (dirty evictions)
+**   cpu=n	bind to this CPU and use its caches (default: CPU 0 caches,
+**		no binding)
+**   interval=sec	report interval in seconds (default 1)
+**   duration=sec	duration of the run (default 0: until interrupted)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#include "usemem.h"
+
+#define	CHUNK	256		// lines touched between clock reads
+
+static volatile sig_atomic_t	stop;
+
+static long long	cachesize(int, int *, long *, char *, size_t);
+static void		catchstop(int);
+
+int
+pollutemode(struct uconf *cf)
+{
+	char			*p, *msg, *cache, cpus[64];
+	volatile char		*q;
+	int			cpu, level, writing, interval, duration, perffd, i;
+	long			linesize = 64;
+	long long		csize, alive, stride, rate, off, lines, total,
+				misses;
+	unsigned long long	start, last, t, due;
+
+	cache    = modeopt(cf, "cache") ? strdup(modeopt(cf, "cache")) : "LLC";
+	cpu      = modeoptnum(cf, "cpu",      -1);
+	writing  = modeopt(cf, "write") != NULL;
+	rate     = modeoptnum(cf, "rate",     0);
+	interval = modeoptnum(cf, "interval", 1);
+	duration = modeoptnum(cf, "duration", 0);
+
+	if (strcasecmp(cache, "L2") == 0)
+		level = 2;
+	else if (strcasecmp(cache, "LLC") == 0)
+		level = 0;	// highest level found
+	else
+		level = -1;
+
+	if (level == -1 || rate < 0 || interval <= 0 || duration < 0) {
+		fprintf(stderr, "invalid options for pollute mode\n");
+		return 1;
+	}
+
+	if (cpu != -1 && pincpu(cpu) == -1) {
+		perror("bind to cpu");
+		return 1;
+	}
+
+	// size the alive set relative to the cache
+	//
+	csize = cachesize(cpu == -1 ? 0 : cpu, &level, &linesize,
+	                  cpus, sizeof cpus);
+
+	if (csize <= 0) {
+		fprintf(stderr, "no %s cache information in sysfs\n", cache);
+		return 1;
+	}
+
+	stride = modeoptnum(cf, "stride", linesize);
+	alive  = cf->physical ? cf->physical :
+	                        csize * modeoptnum(cf, "pct", 200) / 100;
+	alive  = alive / stride * stride;
+
+	if (stride < linesize || alive < stride) {
+		fprintf(stderr, "invalid alive set or stride "
+		                "(at least %ld bytes)\n", linesize);
+		return 1;
+	}
+
+	if (alive > cf->virtual) {
+		fprintf(stderr, "virtsize must be at least %lld KiB\n",
+		                alive / 1024);
+		return 1;
+	}
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	preadvise(cf, p, cf->virtual);
+	memset(p, 'X', alive);
+	postadvise(cf, p, cf->virtual);
+
+	printf("L%d cache %lld KiB (line %ld bytes, shared by CPUs %s): "
+	       "alive set %lld KiB (%lld%%), stride %lld, %s\n",
+	       level, csize / 1024, linesize, cpus, alive / 1024,
+	       alive * 100 / csize, stride,
+	       writing ? "stores" : "loads");
+
+	perffd = perfopen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+
+	printf("%6s %14s %10s %10s %8s %14s\n", "sec", "lines/s", "MiB/s",
+	       "ns/line", "sweeps", "cachemiss/s");
+	fflush(stdout);
+
+	signal(SIGINT,  catchstop);
+	signal(SIGTERM, catchstop);
+
+	// sweep the alive set with the stride, paced in chunks
+	//
+	start = last = nanotime();
+	off   = lines = total = 0;
+	q     = p;
+
+	perfstart(perffd);
+
+	while (!stop) {
+		for (i=0; i < CHUNK; i++) {
+			if (writing)
+				q[off]++;
+			else
+				(void) q[off];
+
+			if ( (off += stride) >= alive)
+				off = 0;
+		}
+
+		lines += CHUNK;
+		total += CHUNK;
+		t      = nanotime();
+
+		if (t - last >= interval * 1000000000ULL) {
+			misses = perfstop(perffd);
+
+			printf("%6llu %14.0f %10.1f %10.2f %8.1f ",
+			       (t - start) / 1000000000ULL,
+			       lines / ((t - last) / 1e9),
+			       lines * (double)linesize / 1048576 /
+			                ((t - last) / 1e9),
+			       (double)(t - last) / lines,
+			       (double)lines * stride / alive);
+
+			if (misses >= 0)
+				printf("%14.0f\n", misses / ((t - last) / 1e9));
+			else
+				printf("%14s\n", "-");
+
+			fflush(stdout);
+
+			perfstart(perffd);
+			last  = t;
+			lines = 0;
+
+			if (duration && t - start >= duration * 1000000000ULL)
+				break;
+		}
+
+		if (rate) {
+			due = start + total * 1000000000ULL / rate;
+
+			if (due > t)
+				usleep((due - t) / 1000);
+		}
+	}
+
+	return 0;
+}
+
+/*
+** obtain the size of the data or unified cache of a CPU for the given
+** level (0: highest level, replaced by the level found), together with
+** its line size and the list of CPUs sharing it
+*/
+static long long cachesize(int cpu, int *level, long *linesize,
+                           char *cpus, size_t len)
+{
+	char		path[128], buf[64];
+	int		i, lvl, best = 0;
+	long long	size = -1;
+
+	for (i=0; ; i++) {
+		snprintf(path, sizeof path,
+		         "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+		         cpu, i);
+
+		if (readfile(path, buf, sizeof buf) == -1)
+			break;
+
+		lvl = atoi(buf);
+
+		if ((*level && lvl != *level) || (!*level && lvl <= best))
+			continue;
+
+		snprintf(path, sizeof path,
+		         "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, i);
+
+		if (readfile(path, buf, sizeof buf) == -1 ||
+		    strcmp(buf, "Instruction") == 0)
+			continue;
+
+		snprintf(path, sizeof path,
+		         "/sys/devices/system/cpu/cpu%d/cache/index%d/size", cpu, i);
+
+		if (readfile(path, buf, sizeof buf) == -1)
+			continue;
+
+		size = getnum(buf);
+		best = lvl;
+
+		snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/"
+		         "cache/index%d/coherency_line_size", cpu, i);
+
+		*linesize = readfile(path, buf, sizeof buf) == 0 ? atol(buf) : 64;
+
+		snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/"
+		         "cache/index%d/shared_cpu_list", cpu, i);
+
+		if (readfile(path, cpus, len) == -1)
+			snprintf(cpus, len, "?");
+	}
+
+	if (size > 0)
+		*level = best;
+
+	return size;
+}
+
+static void catchstop(int sig)
+{
+	stop = 1;
+}
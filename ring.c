@@ -0,0 +1,554 @@
+/* ring.c
+**
+** Measurement mode 'ring': throughput and latency of messages passed
+** between processes via a lock-free ring buffer in shared memory
+**
+** Usage: usemem -x ring [-o options] [-s|-S] [-h] virtsize
+**
+**   The shared segment of virtsize is created as Posix shared memory
+**   (flag -s), System V shared memory (flag -S, huge pages with -h) or
+**   otherwise as memfd (huge pages with -h).  It is divided into one
+**   single-producer/single-consumer ring per pair of processes.
+**
+**   The throughput is measured by passing count messages at full speed.
+**   The latency is measured afterwards by ping-pong: the producer stores
+**   one message in the empty ring and waits until the consumer has
+**   copied it (tail reaches head).  Half of this round trip is counted
+**   as transfer latency, so queueing in a full ring is not included.
+**
+** Options (-o):
+**   msg=sz	message size (default 64, minimum 16)
+**   count=n	number of messages per pair for throughput
+**		(default 5000000)
+**   pings=n	number of ping-pong messages per pair for latency
+**		(default 100000)
+**   pairs=n	number of producer/consumer pairs (default 1)
+**   place=list	colon-separated placements of producer and consumer
+**		(default none):
+**		  none	  no CPU binding
+**		  same	  same logical CPU
+**		  smt	  SMT siblings of the same core
+**		  core	  different cores of the same socket
+**		  socket  different sockets
+**		  all	  all placements available on this system
+**		a placement applies to the first pair, others pairs are
+**		bound to the next CPUs with the same relation
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "usemem.h"
+
+#ifndef	MFD_HUGETLB
+#define	MFD_HUGETLB	0x0004U
+#endif
+
+#define	CACHELINE	64
+#define	READYWAIT	10		// max seconds until processes are ready
+
+struct ring {
+	unsigned long	head __attribute__((aligned(CACHELINE)));
+	unsigned long	tail __attribute__((aligned(CACHELINE)));
+	int		ready __attribute__((aligned(CACHELINE)));
+	int		go;
+	char		data[] __attribute__((aligned(CACHELINE)));
+};
+
+struct ringresult {
+	char			type;	// 't' throughput (consumer),
+					// 'l' latency (producer)
+	long long		msgs, errors;
+	unsigned long long	elapsed, p50, p99, p999, max;
+};
+
+static long		msgsize, count, pings, nslots;
+static int		yield;		// producer and consumer share a CPU
+
+static char		*allocshared(struct uconf *, long long, char **);
+static int		placecpus(char *, int, int *, int *);
+static int		startwait(char *, long, int);
+static void		stopall(pid_t *, int);
+static int		readresult(int, struct ringresult *);
+static void		startsignal(struct ring *);
+static void		producer(struct ring *, int);
+static void		consumer(struct ring *, int);
+
+int
+ringmode(struct uconf *cf)
+{
+	char			*seg, *msg, *places, *place, item[16];
+	long			ringsize;
+	int			pairs, i, pfd[2], cpu1, cpu2;
+	struct ring		*r;
+	struct ringresult	res, tot;
+	pid_t			*pids;
+
+	msgsize = modeoptnum(cf, "msg",   64);
+	count   = modeoptnum(cf, "count", 5000000);
+	pings   = modeoptnum(cf, "pings", 100000);
+	pairs   = modeoptnum(cf, "pairs", 1);
+	places  = strdup(modeopt(cf, "place") ? modeopt(cf, "place") : "none");
+
+	msgsize = (msgsize + 7) / 8 * 8;
+
+	if (msgsize < 16 || count <= 0 || pings <= 0 || pairs <= 0) {
+		fprintf(stderr, "invalid options for ring mode\n");
+		return 1;
+	}
+
+	if ( (pids = calloc(2 * pairs, sizeof *pids)) == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (strcmp(places, "all") == 0)
+		places = "same:smt:core:socket";
+
+	// divide the segment into rings with a power of 2 slots
+	//
+	ringsize = cf->virtual / pairs / CACHELINE * CACHELINE;
+
+	for (nslots=1; sizeof(struct ring) + nslots * 2 * msgsize <= ringsize; )
+		nslots *= 2;
+
+	if (nslots < 2) {
+		fprintf(stderr, "virtsize too small for %d rings\n", pairs);
+		return 1;
+	}
+
+	if ( (seg = allocshared(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	printf("%d ring(s) of %ld slots of %ld bytes in %s, %ld messages "
+	       "and %ld pings per pair\n", pairs, nslots, msgsize, msg, count,
+	       pings);
+	printf("%-7s %9s %12s %10s %9s %9s %9s %9s %7s\n", "place", "cpus",
+	       "msgs/s", "MiB/s", "p50 ns", "p99 ns", "p99.9 ns", "max ns",
+	       "errors");
+
+	for (place = places; *place; place += strcspn(place, ":"),
+	                             place += *place == ':') {
+		snprintf(item, sizeof item, "%.*s",
+		         (int)strcspn(place, ":"), place);
+
+		memset(&tot, 0, sizeof tot);
+
+		if (placecpus(item, 0, &cpu1, &cpu2) == -1) {
+			printf("%-7s %9s\n", item, "n/a");
+			continue;
+		}
+
+		if (pipe(pfd) == -1) {
+			perror("pipe");
+			return 1;
+		}
+
+		fflush(stdout);		// no duplicate output by children
+
+		// start a producer and a consumer per ring
+		//
+		for (i=0; i < pairs; i++) {
+			r = (struct ring *)(seg + i * ringsize);
+			memset(r, 0, sizeof *r);
+
+			placecpus(item, i, &cpu1, &cpu2);
+			yield = (cpu1 != -1 && cpu1 == cpu2) ||
+			        sysconf(_SC_NPROCESSORS_ONLN) == 1;
+
+			if ( (pids[2*i] = fork()) == -1) {
+				perror("fork");
+				stopall(pids, 2*i);
+				return 1;
+			}
+
+			if (pids[2*i] == 0) {
+				close(pfd[0]);
+
+				if (cpu1 != -1)
+					pincpu(cpu1);
+
+				producer(r, pfd[1]);
+				exit(0);
+			}
+
+			if ( (pids[2*i+1] = fork()) == -1) {
+				perror("fork");
+				stopall(pids, 2*i+1);
+				return 1;
+			}
+
+			if (pids[2*i+1] == 0) {
+				close(pfd[0]);
+
+				if (cpu2 != -1)
+					pincpu(cpu2);
+
+				consumer(r, pfd[1]);
+				exit(0);
+			}
+		}
+
+		close(pfd[1]);		// EOF when all children are gone
+
+		// release all processes at once
+		//
+		if (startwait(seg, ringsize, pairs) == -1) {
+			fprintf(stderr, "producer or consumer failed to start\n");
+			stopall(pids, 2 * pairs);
+			return 1;
+		}
+
+		for (i=0; i < pairs; i++) {
+			r = (struct ring *)(seg + i * ringsize);
+			__atomic_store_n(&r->go, 1, __ATOMIC_RELEASE);
+		}
+
+		for (i=0; i < 2 * pairs; i++) {
+			if (readresult(pfd[0], &res) == -1) {
+				fprintf(stderr, "producer or consumer failed\n");
+				stopall(pids, 2 * pairs);
+				return 1;
+			}
+
+			if (res.type == 't') {
+				tot.msgs   += res.msgs;
+				tot.errors += res.errors;
+
+				if (res.elapsed > tot.elapsed)
+					tot.elapsed = res.elapsed;
+
+				continue;
+			}
+
+			// latencies of the slowest pair
+			//
+			if (res.p99 > tot.p99) {
+				tot.p50  = res.p50;
+				tot.p99  = res.p99;
+				tot.p999 = res.p999;
+			}
+
+			if (res.max > tot.max)
+				tot.max = res.max;
+		}
+
+		while (wait(NULL) > 0)
+			;
+
+		close(pfd[0]);
+
+		placecpus(item, 0, &cpu1, &cpu2);
+
+		printf("%-7s %4d:%-4d %12.0f %10.1f %9llu %9llu %9llu %9llu %7lld\n",
+		       item, cpu1, cpu2,
+		       tot.msgs / (tot.elapsed / 1e9),
+		       tot.msgs * msgsize / (tot.elapsed / 1e9) / (1024*1024),
+		       tot.p50, tot.p99, tot.p999, tot.max, tot.errors);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+/*
+** create the shared segment
+*/
+static char *allocshared(struct uconf *cf, long long size, char **msg)
+{
+	char	*p;
+	int	fd;
+
+	if (cf->alloctype == 's' || cf->alloctype == 'S')
+		return allocmem(cf, size, msg);
+
+	*msg = cf->hflag ? "memfd with huge pages" : "memfd";
+
+	if ( (fd = memfd_create("usemem", cf->hflag ? MFD_HUGETLB : 0)) == -1)
+		return NULL;
+
+	if (ftruncate(fd, size) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+** determine the CPUs of producer and consumer of a pair
+** for a placement, or -1 when not bound
+** returns -1 when the placement is not possible
+*/
+static int placecpus(char *place, int pair, int *cpu1, int *cpu2)
+{
+	static int	*sock, *core;	// topology, read once
+	static long	ncpus;
+	int		c1, c2, found = 0;
+
+	*cpu1 = *cpu2 = -1;
+
+	if (strcmp(place, "none") == 0)
+		return 0;
+
+	if (strcmp(place, "same") && strcmp(place, "smt") &&
+	    strcmp(place, "core") && strcmp(place, "socket")) {
+		fprintf(stderr, "wrong placement: %s\n", place);
+		exit(1);
+	}
+
+	if (!sock) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		if ( (sock = malloc(ncpus * sizeof *sock)) == NULL ||
+		     (core = malloc(ncpus * sizeof *core)) == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+
+		for (c1=0; c1 < ncpus; c1++) {
+			sock[c1] = cputopo(c1, "physical_package_id");
+			core[c1] = cputopo(c1, "core_id");
+		}
+	}
+
+	// search the pair-th combination of CPUs with the
+	// requested relation
+	//
+	for (c1=0; c1 < ncpus; c1++) {
+		for (c2 = (*place == 's' && place[1] == 'a') ? c1 : c1+1;
+		     c2 < ncpus; c2++) {
+			int	samecore, samesock;
+
+			samesock = sock[c1] == sock[c2];
+			samecore = samesock && core[c1] == core[c2];
+
+			if ((c1 == c2) ||
+			    (strcmp(place, "smt")    == 0 &&  samecore) ||
+			    (strcmp(place, "core")   == 0 && !samecore && samesock) ||
+			    (strcmp(place, "socket") == 0 && !samesock)) {
+				if (found++ == pair) {
+					*cpu1 = c1;
+					*cpu2 = c2;
+					return 0;
+				}
+			}
+
+			if (c1 == c2)
+				break;
+		}
+	}
+
+	return -1;
+}
+
+/*
+** wait until the producer and consumer of every ring are ready
+** returns -1 when a child terminated or the wait takes too long
+*/
+static int startwait(char *seg, long ringsize, int pairs)
+{
+	unsigned long long	start = nanotime();
+	struct ring		*r;
+	int			i;
+
+	for (i=0; i < pairs; i++) {
+		r = (struct ring *)(seg + i * ringsize);
+
+		while (__atomic_load_n(&r->ready, __ATOMIC_ACQUIRE) < 2) {
+			if (waitpid(-1, NULL, WNOHANG) > 0 ||
+			    nanotime() - start > READYWAIT * 1000000000ULL)
+				return -1;
+
+			sched_yield();
+		}
+	}
+
+	return 0;
+}
+
+/*
+** kill and reap the children that were started
+*/
+static void stopall(pid_t *pids, int n)
+{
+	int	i;
+
+	for (i=0; i < n; i++)
+		if (pids[i] > 0)
+			kill(pids[i], SIGKILL);
+
+	while (wait(NULL) > 0)
+		;
+}
+
+/*
+** read the result of a producer or consumer, while checking
+** that no child has terminated abnormally
+** returns -1 on failure
+*/
+static int readresult(int fd, struct ringresult *res)
+{
+	struct pollfd	pfd = { .fd = fd, .events = POLLIN };
+	int		status;
+
+	while (poll(&pfd, 1, 1000) == 0) {
+		if (waitpid(-1, &status, WNOHANG) > 0 &&
+		    (!WIFEXITED(status) || WEXITSTATUS(status)))
+			return -1;
+	}
+
+	return read(fd, res, sizeof *res) == sizeof *res ? 0 : -1;
+}
+
+/*
+** wait until all processes are ready to start
+*/
+static void startsignal(struct ring *r)
+{
+	__atomic_add_fetch(&r->ready, 1, __ATOMIC_ACQ_REL);
+
+	while (!__atomic_load_n(&r->go, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+/*
+** producer: store count messages with sequence number at full speed,
+** and then measure the latency by ping-pong (one message at a time)
+*/
+static void producer(struct ring *r, int fd)
+{
+	unsigned long		head = 0, tail = 0, mask = nslots - 1;
+	unsigned long long	*lat, t;
+	struct ringresult	res;
+	char			*buf, *slot;
+	long			i;
+
+	if ( (buf = malloc(msgsize)) == NULL ||
+	     (lat = malloc(pings * sizeof *lat)) == NULL)
+		exit(1);
+
+	memset(buf, 'M', msgsize);
+	startsignal(r);
+
+	for (i=0; i < count; i++) {
+		// wait for a free slot, only reading the shared
+		// tail when the cached value indicates a full ring
+		//
+		while (head - tail >= nslots) {
+			tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+			if (head - tail >= nslots && yield)
+				sched_yield();
+		}
+
+		slot = r->data + (head & mask) * msgsize;
+
+		((unsigned long long *)buf)[1] = i;
+		memcpy(slot, buf, msgsize);
+
+		__atomic_store_n(&r->head, ++head, __ATOMIC_RELEASE);
+	}
+
+	// ping-pong: the ring is empty before every message and
+	// the consumer acknowledges by advancing the tail
+	//
+	while (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) != head)
+		if (yield)
+			sched_yield();
+
+	for (i=0; i < pings; i++) {
+		t    = nanotime();
+		slot = r->data + (head & mask) * msgsize;
+
+		((unsigned long long *)buf)[1] = count + i;
+		memcpy(slot, buf, msgsize);
+
+		__atomic_store_n(&r->head, ++head, __ATOMIC_RELEASE);
+
+		while (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) != head)
+			if (yield)
+				sched_yield();
+
+		lat[i] = (nanotime() - t) / 2;
+	}
+
+	memset(&res, 0, sizeof res);
+	latsort(lat, pings);
+
+	res.type = 'l';
+	res.p50  = latpct(lat, pings, 50);
+	res.p99  = latpct(lat, pings, 99);
+	res.p999 = latpct(lat, pings, 99.9);
+	res.max  = lat[pings-1];
+
+	if (write(fd, &res, sizeof res) != sizeof res)
+		exit(1);
+}
+
+/*
+** consumer: copy all messages and verify the sequence;
+** the throughput is measured over the first count messages
+*/
+static void consumer(struct ring *r, int fd)
+{
+	unsigned long		head = 0, tail = 0, mask = nslots - 1;
+	unsigned long long	start;
+	struct ringresult	res;
+	long			i;
+	char			*buf, *slot;
+
+	if ( (buf = malloc(msgsize)) == NULL)
+		exit(1);
+
+	memset(&res, 0, sizeof res);
+	startsignal(r);
+
+	start = nanotime();
+
+	for (i=0; i < count + pings; i++) {
+		while (tail == head) {
+			head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+			if (tail == head && yield)
+				sched_yield();
+		}
+
+		slot = r->data + (tail & mask) * msgsize;
+		memcpy(buf, slot, msgsize);
+
+		__atomic_store_n(&r->tail, ++tail, __ATOMIC_RELEASE);
+
+		if (((unsigned long long *)buf)[1] != i)
+			res.errors++;
+
+		if (i == count - 1)
+			res.elapsed = nanotime() - start;
+	}
+
+	res.type = 't';
+	res.msgs = count;
+
+	if (write(fd, &res, sizeof res) != sizeof res)
+		exit(1);
+}
@@ -0,0 +1,367 @@
+/* snapshot.c
+**
+** Measurement modes 'save' and 'restore': warm restart of a populated
+** memory area via a snapshot file
+**
+** Usage: usemem -x save    -o file=path[,...] [-m|-s|-S] [flags] virtsize
+**        usemem -x restore -o file=path[,...] [flags] virtsize
+**
+**   Save references the area of virtsize (every page gets its page
+**   number, to verify a restore) and writes it to the file by a number
+**   of threads in parallel, using buffered or direct I/O (O_DIRECT).
+**
+**   Restore repopulates virtsize (at most the file size) from the file
+**   with one or more methods:
+**	read	  parallel pread() into a new anonymous mapping
+**	direct	  parallel pread() with O_DIRECT into a new anonymous mapping
+**	mmap	  MAP_PRIVATE mapping of the file, touched page by page
+**	prefetch  MAP_PRIVATE mapping of the file, populated by parallel
+**		  threads with MADV_POPULATE_READ
+**   The time until all data is accessible (time-to-ready), the
+**   throughput and the result of the verification are shown per method.
+**   Before every method the file is dropped from the page cache (unless
+**   option cached), so the throughput of the disk is measured.
+**   Saving with direct I/O requires a page-aligned area (flag -m, -s
+**   or -S).  The size is rounded down to a multiple of the page size,
+**   so direct I/O always transfers whole blocks.
+**
+** Options (-o):
+**   file=path	snapshot file
+**   io=type	save with buffered or direct I/O (default buffered)
+**   method=list	colon-separated restore methods
+**		(default read:direct:mmap:prefetch)
+**   threads=n	number of I/O threads (default 4)
+**   chunk=sz	I/O size per request (default 1M)
+**   cached	do not drop the file from the page cache before restore
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "usemem.h"
+
+#ifndef	MADV_POPULATE_READ
+#define	MADV_POPULATE_READ	0	// ignore if not supported
+#endif
+
+struct iojob {
+	pthread_t	tid;
+	int		fd, write, advise, direct;
+	char		*p;
+	long long	start, end, chunk;
+	int		failed;
+};
+
+static volatile int	stopjobs;	// abort the I/O threads
+
+static int		paralleljobs(int, char *, long long, long long, int,
+			             int, int);
+static void		*iothread(void *);
+static long long	verify(char *, long long, long);
+
+int
+savemode(struct uconf *cf)
+{
+	char			*p, *msg, *file, *io;
+	long long		size, chunk, off;
+	int			fd, threads, direct;
+	unsigned long long	t, tsync;
+
+	file    = modeopt(cf, "file") ? strdup(modeopt(cf, "file")) : NULL;
+	io      = strdup(modeopt(cf, "io") ? modeopt(cf, "io") : "buffered");
+	threads = modeoptnum(cf, "threads", 4);
+	chunk   = modeoptnum(cf, "chunk",   1024*1024);
+	direct  = strcmp(io, "direct") == 0;
+	size    = cf->virtual / cf->pagesize * cf->pagesize;
+
+	if (!file || (!direct && strcmp(io, "buffered")) || threads <= 0 ||
+	    chunk <= 0 || chunk % cf->pagesize || size == 0) {
+		fprintf(stderr, "invalid options for save mode\n");
+		return 1;
+	}
+
+	if ( (p = allocmem(cf, size, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	if (direct && (unsigned long)p % cf->pagesize) {
+		fprintf(stderr, "direct I/O requires a page-aligned area "
+		                "(flag -m, -s or -S)\n");
+		return 1;
+	}
+
+	preadvise(cf, p, size);
+
+	for (off=0; off < size; off += cf->pagesize) {
+		memset(p + off, 'S', cf->pagesize);
+		*(long long *)(p + off) = off / cf->pagesize;
+	}
+
+	postadvise(cf, p, size);
+
+	if ( (fd = open(file, O_WRONLY|O_CREAT|O_TRUNC|(direct ? O_DIRECT : 0),
+	                0600)) == -1) {
+		perror(file);
+		return 1;
+	}
+
+	if (ftruncate(fd, size) == -1) {
+		perror("ftruncate");
+		return 1;
+	}
+
+	t = nanotime();
+
+	if (paralleljobs(fd, p, size, chunk, threads, 1, 0) == -1) {
+		perror("write snapshot");
+		return 1;
+	}
+
+	tsync = nanotime();
+	fsync(fd);
+	t     = nanotime() - t;
+	tsync = nanotime() - tsync;
+
+	close(fd);
+
+	printf("%lld KiB (%s) saved to %s with %s I/O by %d threads in "
+	       "%.3f sec (fsync %.3f sec): %.2f GB/s\n", size/1024, msg,
+	       file, io, threads, t / 1e9, tsync / 1e9, size / (double)t);
+	fflush(stdout);
+
+	return 0;
+}
+
+int
+restoremode(struct uconf *cf)
+{
+	char			*p, *file, *methods, *m, item[16];
+	long long		size, chunk, bad;
+	int			fd, threads, cached;
+	struct stat		st;
+	unsigned long long	t;
+
+	file    = modeopt(cf, "file") ? strdup(modeopt(cf, "file")) : NULL;
+	methods = strdup(modeopt(cf, "method") ? modeopt(cf, "method") :
+	                                         "read:direct:mmap:prefetch");
+	threads = modeoptnum(cf, "threads", 4);
+	chunk   = modeoptnum(cf, "chunk",   1024*1024);
+	cached  = modeopt(cf, "cached") != NULL;
+
+	if (!file || threads <= 0 || chunk <= 0 || chunk % cf->pagesize) {
+		fprintf(stderr, "invalid options for restore mode\n");
+		return 1;
+	}
+
+	for (m = methods; *m; m += strcspn(m, ":"), m += *m == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(m, ":"), m);
+
+		if (strcmp(item, "read") && strcmp(item, "direct") &&
+		    strcmp(item, "mmap") && strcmp(item, "prefetch")) {
+			fprintf(stderr, "wrong method: %s\n", item);
+			return 1;
+		}
+
+		if (strcmp(item, "prefetch") == 0 && MADV_POPULATE_READ == 0) {
+			fprintf(stderr, "method prefetch not supported\n");
+			return 1;
+		}
+	}
+
+	if (stat(file, &st) == -1) {
+		perror(file);
+		return 1;
+	}
+
+	size = cf->virtual < st.st_size ? cf->virtual : st.st_size;
+	size = size / cf->pagesize * cf->pagesize;
+
+	if (size == 0) {
+		fprintf(stderr, "%s: too small to restore\n", file);
+		return 1;
+	}
+
+	printf("restore %lld KiB from %s by %d threads%s\n", size/1024, file,
+	       threads, cached ? " (page cache kept)" : "");
+	printf("%-9s %14s %10s %10s %12s\n", "method", "ready ms", "GB/s",
+	       "errors", "VmRSS KiB");
+
+	for (m = methods; *m; m += strcspn(m, ":"), m += *m == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(m, ":"), m);
+
+		if ( (fd = open(file, O_RDONLY |
+		                (strcmp(item, "direct") ? 0 : O_DIRECT))) == -1) {
+			perror(file);
+			return 1;
+		}
+
+		if (!cached)
+			(void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+		t = nanotime();
+
+		// read and direct use an anonymous mapping regardless of
+		// the memory type, so the area is page-aligned for O_DIRECT
+		// and really released after the method
+		//
+		if (strcmp(item, "read") == 0 || strcmp(item, "direct") == 0) {
+			p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+			         MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+			if (p == MAP_FAILED) {
+				perror("mmap for restore");
+				return 1;
+			}
+
+			preadvise(cf, p, size);
+
+			if (paralleljobs(fd, p, size, chunk, threads, 0, 0) == -1) {
+				perror(item);
+				return 1;
+			}
+		} else {
+			p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+			if (p == MAP_FAILED) {
+				perror("mmap of snapshot");
+				return 1;
+			}
+
+			preadvise(cf, p, size);
+
+			if (strcmp(item, "prefetch") == 0 &&
+			    paralleljobs(fd, p, size, chunk, threads, 0, 1) == -1) {
+				perror(item);
+				return 1;
+			}
+
+			(void) verify(p, size, cf->pagesize);	// touch all pages
+		}
+
+		t   = nanotime() - t;
+		bad = verify(p, size, cf->pagesize);
+
+		printf("%-9s %14.1f %10.2f %10lld %12lld\n", item, t / 1e6,
+		       size / (double)t, bad,
+		       procvalue("/proc/self/status", "VmRSS:"));
+		fflush(stdout);
+
+		(void) munmap(p, size);
+		close(fd);
+	}
+
+	return 0;
+}
+
+/*
+** divide the area over threads that each handle their part in chunks:
+** write to the file, read from the file, or populate the mapping
+** returns -1 on failure with errno set
+*/
+static int paralleljobs(int fd, char *p, long long size, long long chunk,
+                        int threads, int write, int advise)
+{
+	struct iojob	*jobs;
+	long long	part;
+	int		i, n, failed = 0;
+
+	if ( (jobs = calloc(threads, sizeof *jobs)) == NULL)
+		return -1;
+
+	stopjobs = 0;
+	part     = (size / threads + chunk - 1) / chunk * chunk;
+
+	for (i=0; i < threads; i++) {
+		jobs[i].fd     = fd;
+		jobs[i].p      = p;
+		jobs[i].write  = write;
+		jobs[i].advise = advise;
+		jobs[i].chunk  = chunk;
+		jobs[i].direct = (fcntl(fd, F_GETFL) & O_DIRECT) != 0;
+		jobs[i].start  = i * part < size ? i * part : size;
+		jobs[i].end    = (i+1) * part < size ? (i+1) * part : size;
+
+		if ( (jobs[i].failed = pthread_create(&jobs[i].tid, NULL,
+		                                      iothread, &jobs[i])) ) {
+			stopjobs = 1;	// stop the threads already started
+			break;
+		}
+	}
+
+	for (n=i, i=0; i < threads; i++) {
+		if (i < n)		// thread was started
+			pthread_join(jobs[i].tid, NULL);
+
+		if (jobs[i].failed) {
+			failed = jobs[i].failed;
+			errno  = failed;
+		}
+	}
+
+	free(jobs);
+
+	return failed ? -1 : 0;
+}
+
+static void *iothread(void *arg)
+{
+	struct iojob	*job = arg;
+	long long	off, len;
+	ssize_t		n;
+
+	for (off = job->start; off < job->end && !job->failed && !stopjobs;
+	     off += n) {
+		len = off + job->chunk > job->end ? job->end - off : job->chunk;
+
+		if (job->advise) {
+			if (madvise(job->p + off, len, MADV_POPULATE_READ) == -1)
+				job->failed = errno;
+
+			n = len;
+			continue;
+		}
+
+		if (job->write)
+			n = pwrite(job->fd, job->p + off, len, off);
+		else
+			n = pread(job->fd, job->p + off, len, off);
+
+		if (n <= 0)
+			job->failed = n == 0 ? EIO : errno;
+		else if (job->direct && n < len)
+			job->failed = EIO;	// next offset would be unaligned
+	}
+
+	return NULL;
+}
+
+/*
+** verify (and thereby touch) the page numbers in the area
+** returns the number of wrong pages
+*/
+static long long verify(char *p, long long size, long pagesize)
+{
+	long long	off, bad = 0;
+
+	for (off=0; off < size; off += pagesize)
+		if (*(volatile long long *)(p + off) != off / pagesize)
+			bad++;
+
+	return bad;
+}
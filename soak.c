@@ -0,0 +1,324 @@
+/* soak.c
+**
+** Measurement mode 'soak': steady workload for runs of days, with
+** compact aggregates per period and detection of drift over time
+**
+** Usage: usemem -x soak [-o options] [-m|-s|-S] [flags]
+**                                     virtsize [physsize [alivesize]]
+**
+**   Like usemem itself, virtsize is allocated, physsize is referenced
+**   once and alivesize is referenced every second.  The alive set is
+**   touched in chunks of which the latency is kept in a histogram.  With
+**   option churn, a rotating window of the referenced memory is released
+**   (MADV_DONTNEED) and faulted in again every second, to measure the
+**   fault cost and to give fragmentation a chance.
+**
+**   Per period (default an hour) one aggregate is kept with:
+**	- touch latency percentiles per chunk (p50, p99, p99.9)
+**	- THP coverage (AnonHugePages of the process relative to its
+**	  anonymous memory)
+**	- fault cost (time per page faulted in by the churn)
+**	- compaction stalls (compact_stall of /proc/vmstat)
+**	- swap rate (pages swapped in and out per second, system-wide)
+**   Only the most recent aggregates are kept (option keep), so memory
+**   usage is bounded for any duration.  After every period a linear
+**   least-squares trend is computed per metric over the kept aggregates.
+**   A trend is flagged as drift when its t-statistic (slope divided by
+**   its standard error) exceeds 3, with at least 6 aggregates.
+**
+** Options (-o):
+**   period=sec	duration of one aggregate (default 3600)
+**   chunk=sz	unit of latency measurement (default 64K)
+**   churn=sz	memory released and refaulted per second (default 0)
+**   keep=n	number of aggregates kept for drift detection (default 168)
+**   duration=sec	duration of the run (default 0: until interrupted)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "usemem.h"
+
+#define	SUBBUCKETS	4		// histogram buckets per power of 2
+#define	NBUCKETS	(48*SUBBUCKETS)	// up to 2^48 ns
+
+enum { M_P50, M_P99, M_P999, M_THP, M_FAULT, M_COMPACT, M_SWAP, NMETRICS };
+
+static char *metricnames[NMETRICS] = {
+	"p50 us", "p99 us", "p99.9 us", "THP %", "fault ns", "compact", "swap/s",
+};
+
+struct aggregate {
+	unsigned int	hist[NBUCKETS];
+	double		metric[NMETRICS];
+};
+
+static volatile sig_atomic_t	stop;
+
+static int		bucket(unsigned long long);
+static double		histpct(unsigned int *, double);
+static void		drift(struct aggregate *, int, int, int);
+static void		catchstop(int);
+
+int
+soakmode(struct uconf *cf)
+{
+	char			*p, *msg;
+	struct aggregate	*agg, *a;
+	struct rollup		ru;
+	long long		chunk, churn, window, off, len, faultpages,
+				compact0, swap0;
+	long			period, duration, keep, nagg, i;
+	unsigned long long	start, pstart, t, faulttime;
+
+	period   = modeoptnum(cf, "period",   3600);
+	chunk    = modeoptnum(cf, "chunk",    64*1024);
+	churn    = modeoptnum(cf, "churn",    0);
+	keep     = modeoptnum(cf, "keep",     168);
+	duration = modeoptnum(cf, "duration", 0);
+
+	churn = churn / cf->pagesize * cf->pagesize;
+
+	if (period <= 0 || chunk <= 0 || churn < 0 || churn > cf->physical ||
+	    keep < 2 || duration < 0) {
+		fprintf(stderr, "invalid options for soak mode\n");
+		return 1;
+	}
+
+	if (!cf->keepalive && !churn) {
+		fprintf(stderr, "soak mode requires alivesize and/or churn\n");
+		return 1;
+	}
+
+	if ( (agg = calloc(keep, sizeof *agg)) == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	preadvise(cf, p, cf->virtual);
+
+	if (cf->physical)
+		memset(p, 'X', cf->physical);
+
+	postadvise(cf, p, cf->virtual);
+
+	printf("%lld KiB allocated (%s) / %lld KiB referenced / %lld KiB "
+	       "alive / %lld KiB churn per second, period %ld sec\n",
+	       cf->virtual/1024, msg, cf->physical/1024, cf->keepalive/1024,
+	       churn/1024, period);
+	printf("%8s", "period");
+
+	for (i=0; i < NMETRICS; i++)
+		printf(" %10s", metricnames[i]);
+
+	printf("\n");
+	fflush(stdout);
+
+	signal(SIGINT,  catchstop);
+	signal(SIGTERM, catchstop);
+
+	start  = nanotime();
+	window = 0;
+
+	for (nagg=0; !stop; nagg++) {
+		a = &agg[nagg % keep];
+		memset(a, 0, sizeof *a);
+
+		pstart     = nanotime();
+		compact0   = procvalue("/proc/vmstat", "compact_stall");
+		swap0      = procvalue("/proc/vmstat", "pswpin") +
+		             procvalue("/proc/vmstat", "pswpout");
+		faulttime  = faultpages = 0;
+
+		// one period of ticks of a second
+		//
+		while (!stop && nanotime() - pstart < period * 1000000000ULL) {
+			sleep(1);
+
+			for (off=0; off < cf->keepalive; off += chunk) {
+				len = off + chunk > cf->keepalive ?
+				      cf->keepalive - off : chunk;
+
+				t = nanotime();
+				memset(p + off, 'X', len);
+				a->hist[bucket(nanotime() - t)]++;
+			}
+
+			if (churn) {
+				if (window + churn > cf->physical)
+					window = 0;
+
+				(void) madvise(p + window, churn, MADV_DONTNEED);
+
+				t = nanotime();
+				memset(p + window, 'X', churn);
+				faulttime  += nanotime() - t;
+				faultpages += churn / cf->pagesize;
+
+				window += churn;
+			}
+
+			if (duration && nanotime() - start >= duration * 1000000000ULL)
+				stop = 1;
+		}
+
+		// complete the aggregate of this period
+		//
+		t = nanotime() - pstart;
+		rollup(&ru);
+
+		a->metric[M_P50]     = histpct(a->hist, 50)   / 1e3;
+		a->metric[M_P99]     = histpct(a->hist, 99)   / 1e3;
+		a->metric[M_P999]    = histpct(a->hist, 99.9) / 1e3;
+		a->metric[M_THP]     = ru.anon > 0 ? ru.anonhuge * 100.0 / ru.anon : 0;
+		a->metric[M_FAULT]   = faultpages ? (double)faulttime / faultpages : 0;
+		a->metric[M_COMPACT] = procvalue("/proc/vmstat", "compact_stall") -
+		                       compact0;
+		a->metric[M_SWAP]    = (procvalue("/proc/vmstat", "pswpin") +
+		                        procvalue("/proc/vmstat", "pswpout") -
+		                        swap0) / (t / 1e9);
+
+		printf("%8ld", nagg + 1);
+
+		for (i=0; i < NMETRICS; i++)
+			printf(" %10.1f", a->metric[i]);
+
+		printf("\n");
+
+		drift(agg, keep, nagg + 1, period);
+		fflush(stdout);
+	}
+
+	return 0;
+}
+
+/*
+** histogram bucket for a latency in ns: SUBBUCKETS buckets per power of 2
+*/
+static int bucket(unsigned long long ns)
+{
+	int	shift = 0, b;
+
+	if (ns < SUBBUCKETS)
+		return ns;
+
+	while ((ns >> shift) >= 2 * SUBBUCKETS)
+		shift++;
+
+	b = shift * SUBBUCKETS + (ns >> shift);
+
+	return b < NBUCKETS ? b : NBUCKETS - 1;
+}
+
+/*
+** percentile of the histogram (lower bound of the bucket in ns)
+*/
+static double histpct(unsigned int *hist, double pct)
+{
+	unsigned long long	total = 0, sum = 0;
+	int			b, shift;
+
+	for (b=0; b < NBUCKETS; b++)
+		total += hist[b];
+
+	if (!total)
+		return 0;
+
+	for (b=0; b < NBUCKETS; b++) {
+		sum += hist[b];
+
+		if (sum * 100.0 >= total * pct)
+			break;
+	}
+
+	if (b >= NBUCKETS)		// rounding of pct
+		b = NBUCKETS - 1;
+
+	if (b < SUBBUCKETS)
+		return b;
+
+	shift = b / SUBBUCKETS - 1;
+
+	// in 64 bits: the top buckets exceed the range of an int
+	//
+	return (double)((unsigned long long)(b % SUBBUCKETS + SUBBUCKETS) <<
+	                shift);
+}
+
+/*
+** least-squares trend per metric over the kept aggregates,
+** shown when the slope is significant (t-statistic above 3)
+*/
+static void drift(struct aggregate *agg, int keep, int nagg, int period)
+{
+	int	n = nagg < keep ? nagg : keep, first = nagg - n, i, m;
+	double	x, y, sx, sy, sxx, sxy, syy, slope, icpt, sse, se, tstat, mean;
+
+	if (n < 6)
+		return;
+
+	for (m=0; m < NMETRICS; m++) {
+		sx = sy = sxx = sxy = syy = 0;
+
+		for (i=first; i < nagg; i++) {
+			x    = i;
+			y    = agg[i % keep].metric[m];
+			sx  += x;
+			sy  += y;
+			sxx += x * x;
+			sxy += x * y;
+			syy += y * y;
+		}
+
+		if (n * sxx - sx * sx == 0)
+			continue;
+
+		slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+		icpt  = (sy - slope * sx) / n;
+		mean  = sy / n;
+
+		// residual sum of squares and standard error of the slope
+		//
+		for (i=first, sse=0; i < nagg; i++) {
+			y    = agg[i % keep].metric[m] - (icpt + slope * i);
+			sse += y * y;
+		}
+
+		se = sqrt(sse / (n - 2) / (sxx - sx * sx / n));
+
+		if (se == 0)
+			tstat = slope ? INFINITY : 0;
+		else
+			tstat = slope / se;
+
+		if (fabs(tstat) < 3)
+			continue;
+
+		printf("         drift %-9s %+.3f per period (%+.1f%% of mean "
+		       "per day), t=%.1f over %d periods\n", metricnames[m],
+		       slope, mean ? slope / mean * 100 * 86400 / period : 0,
+		       tstat, n);
+	}
+}
+
+static void catchstop(int sig)
+{
+	stop = 1;
+}
@@ -0,0 +1,328 @@
+/* stack.c
+**
+** Measurement mode 'stack': emulate the stacks of many threads
+**
+** Usage: usemem -x stack [-o options] [-t|-n] [-CP] [-l]
+**                                     stacksize [depthsize [alivesize]]
+**
+**   stacksize	size of the stack of each thread
+**   depthsize	stack depth touched once by each thread (recursion)
+**   alivesize	stack depth touched again each second by the active threads
+**
+** Options (-o):
+**   threads=n	number of threads (default 100)
+**   frame=sz	size of one recursion frame (default 1K)
+**   spread=pct	touch a random depth per thread between pct% and 100%
+**		of depthsize (default 100: equal depth for all threads)
+**   active=n	number of threads that touch alivesize each second
+**		(default: all threads); the others stay idle
+**   interval=sec	report interval in seconds (default 10)
+**
+** The flags -C and -P are applied to the stacks of the idle threads
+** after the initial recursion, to observe their reclaim behaviour.
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "usemem.h"
+
+#ifndef	MADV_HUGEPAGE
+#define	MADV_HUGEPAGE	0	// ignore if not supported
+#endif
+
+#ifndef	MADV_NOHUGEPAGE
+#define	MADV_NOHUGEPAGE	0	// ignore if not supported
+#endif
+
+#ifndef	MADV_COLD
+#define	MADV_COLD	0	// ignore if not supported
+#endif
+
+#ifndef	MADV_PAGEOUT
+#define	MADV_PAGEOUT	0	// ignore if not supported
+#endif
+
+#ifndef	MAP_STACK
+#define	MAP_STACK	0
+#endif
+
+struct stackthread {
+	pthread_t	tid;
+	char		*stack;		// lowest address above guard page
+	size_t		size;		// stack size excl. guard page
+	long long	depth;		// initially touched depth
+	char		active;
+};
+
+static pthread_mutex_t	mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	alldone = PTHREAD_COND_INITIALIZER;
+static int		ndone;
+
+static long long	alivedepth;
+static int		framesize;
+
+static void		*stackthread(void *);
+static void		descend(char *, long long);
+static void		stackreport(struct stackthread *, int, long long, long long);
+
+int
+stackmode(struct uconf *cf)
+{
+	struct stackthread	*st;
+	pthread_attr_t		attr;
+	int			i, nthreads, nactive, spread, interval;
+	long long		pte0, swap0, touched = 0;
+	unsigned long long	starttime, endtime;
+	unsigned int		seed = getpid();
+	size_t			stacksize;
+	char			*p;
+
+	nthreads   = modeoptnum(cf, "threads",  100);
+	framesize  = modeoptnum(cf, "frame",    1024);
+	spread     = modeoptnum(cf, "spread",   100);
+	nactive    = modeoptnum(cf, "active",   nthreads);
+	interval   = modeoptnum(cf, "interval", 10);
+	alivedepth = cf->keepalive;
+
+	if (cf->alloctype != 'a' && cf->alloctype != 'm')
+		fprintf(stderr, "warning: -%c flag ignored for stacks\n",
+		                cf->alloctype);
+
+	if (cf->hflag)
+		fprintf(stderr, "warning: -h flag ignored for stacks\n");
+
+	if (nthreads <= 0 || nactive < 0 || nactive > nthreads ||
+	    framesize <= 0 || spread < 0 || spread > 100 || interval <= 0) {
+		fprintf(stderr, "invalid options for stack mode\n");
+		return 1;
+	}
+
+	// reserve room for the thread start and library functions
+	// on top of the stack to be touched
+	//
+	stacksize = (cf->virtual + cf->pagesize - 1) / cf->pagesize * cf->pagesize;
+
+	if (cf->physical + 16 * cf->pagesize + framesize > stacksize) {
+		fprintf(stderr, "depthsize must be at least %ld KiB smaller "
+		                "than stacksize\n",
+		                (16 * cf->pagesize + framesize) / 1024);
+		return 1;
+	}
+
+	if ( (st = calloc(nthreads, sizeof *st)) == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	pte0  = procvalue("/proc/self/status", "VmPTE:");
+	swap0 = procvalue("/proc/self/status", "VmSwap:");
+
+	// allocate the stacks with a guard page at the low end
+	//
+	for (i=0; i < nthreads; i++) {
+		st[i].size = stacksize;
+		p = mmap(NULL, stacksize + cf->pagesize, PROT_READ|PROT_WRITE,
+		         MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_STACK, -1, 0);
+
+		if (p == MAP_FAILED) {
+			perror("mmap for stack");
+			return 1;
+		}
+
+		(void) mprotect(p, cf->pagesize, PROT_NONE);
+
+		st[i].stack = p + cf->pagesize;
+
+		if (cf->tflag)
+			do_advise("-t", MADV_HUGEPAGE,
+			          st[i].stack, stacksize);
+
+		if (cf->nflag)
+			do_advise("-n", MADV_NOHUGEPAGE,
+			          st[i].stack, stacksize);
+
+		if (cf->lflag && mlock(st[i].stack, stacksize) == -1)
+			perror("warning: mlock failed");
+
+		st[i].depth = cf->physical;
+
+		if (spread < 100 && cf->physical)
+			st[i].depth = cf->physical * spread / 100 +
+			    (long long)(rand_r(&seed) / (RAND_MAX + 1.0) *
+			                (cf->physical * (100 - spread) / 100));
+
+		st[i].active = i < nactive;
+		touched     += st[i].depth;
+	}
+
+	// start all threads and wait until the initial recursion
+	// has finished in each of them
+	//
+	starttime = nanotime();
+
+	for (i=0; i < nthreads; i++) {
+		pthread_attr_init(&attr);
+		pthread_attr_setstack(&attr, st[i].stack, st[i].size);
+
+		if ( (errno = pthread_create(&st[i].tid, &attr, stackthread, &st[i])) ) {
+			perror("pthread_create");
+			return 1;
+		}
+
+		pthread_attr_destroy(&attr);
+	}
+
+	pthread_mutex_lock(&mutex);
+
+	while (ndone < nthreads)
+		pthread_cond_wait(&alldone, &mutex);
+
+	pthread_mutex_unlock(&mutex);
+
+	endtime = nanotime();
+
+	printf("%d threads with %lld KiB stack: %lld KiB touched in %.3f sec, "
+	       "page tables %lld KiB\n",
+	       nthreads, (long long)stacksize/1024, touched/1024,
+	       (endtime - starttime) / 1e9,
+	       procvalue("/proc/self/status", "VmPTE:") - pte0);
+
+	// handle advises for the stacks of the idle threads
+	//
+	for (i=nactive; i < nthreads; i++) {
+		if (cf->Cflag)
+			do_advise("-C", MADV_COLD, st[i].stack,
+			          st[i].size);
+
+		if (cf->Pflag)
+			do_advise("-P", MADV_PAGEOUT, st[i].stack,
+			          st[i].size);
+	}
+
+	if (nactive && alivedepth)
+		printf("%d threads keep %lld KiB stack alive...\n",
+		       nactive, alivedepth/1024);
+
+	fflush(stdout);
+
+	// report the state of the stacks periodically
+	//
+	for (;;) {
+		stackreport(st, nthreads, pte0, swap0);
+		sleep(interval);
+	}
+}
+
+/*
+** report the resident size of the stacks of active and idle threads,
+** and the growth of page tables and swap since the stacks were created
+*/
+static void stackreport(struct stackthread *st, int nthreads, long long pte0,
+                        long long swap0)
+{
+	long long	actres = 0, idleres = 0;
+	struct pagestat	ps;
+	long		budget;
+	int		i, step, nact = 0, nidle = 0, sact = 0, sidle = 0;
+
+	// the page map budget of stats.c is shared by all stacks, so the
+	// cost of a report grows neither with the stack size nor with the
+	// number of threads: beyond one window per stack only every
+	// step-th stack is inspected and the totals are extrapolated
+	//
+	step   = (nthreads * STATWINDOW + STATPAGES - 1) / STATPAGES;
+	budget = STATPAGES / ((nthreads + step - 1) / step);
+
+	for (i=0; i < nthreads; i++) {
+		if (st[i].active)
+			nact++;
+		else
+			nidle++;
+
+		if (i % step ||
+		    pagestat(st[i].stack, st[i].size, budget, &ps) == -1)
+			continue;
+
+		if (st[i].active) {
+			actres  += ps.present;
+			sact++;
+		} else {
+			idleres += ps.present;
+			sidle++;
+		}
+	}
+
+	if (sact)
+		actres  = actres  * nact  / sact;
+
+	if (sidle)
+		idleres = idleres * nidle / sidle;
+
+	printf("stacks resident: %lld KiB active / %lld KiB idle, "
+	       "page tables %lld KiB, swapped %lld KiB\n",
+	       actres/1024, idleres/1024,
+	       procvalue("/proc/self/status", "VmPTE:") - pte0,
+	       procvalue("/proc/self/status", "VmSwap:") - swap0);
+	fflush(stdout);
+}
+
+/*
+** thread: touch the stack by recursion, signal the main thread
+** and stay idle or touch the alive part each second
+*/
+static void *stackthread(void *arg)
+{
+	struct stackthread	*me = arg;
+	char			top;
+
+	descend(&top, me->depth);
+
+	pthread_mutex_lock(&mutex);
+
+	ndone++;
+	pthread_cond_signal(&alldone);
+
+	pthread_mutex_unlock(&mutex);
+
+	if (!me->active || !alivedepth) {
+		for (;;)
+			pause();
+	}
+
+	for (;;) {
+		sleep(1);
+		descend(&top, alivedepth);
+	}
+
+	return NULL;
+}
+
+/*
+** recurse with frames of framesize bytes until the stack has
+** grown depth bytes below top
+*/
+static void descend(char *top, long long depth)
+{
+	volatile char	*frame = alloca(framesize);
+
+	memset((char *)frame, 'X', framesize);
+
+	if (top - (char *)frame < depth)
+		descend(top, depth);
+
+	frame[0]++;	// prevent tail call optimization
+}
@@ -0,0 +1,368 @@
+/* stats.c
+**
+** Statistics of memory areas that remain cheap for processes with many
+** mappings (VMAs) or huge areas, to be used for periodic reporting
+**
+**   rollup()	 process totals from /proc/self/smaps_rollup, read once
+**		 per call instead of once per value (every read walks
+**		 the page tables of all mappings)
+**   vmacount()	 number of mappings that overlap an area, via ioctl
+**		 PROCMAP_QUERY on /proc/self/maps (Linux 6.11) which only
+**		 visits the mappings concerned, or a scan of the maps file
+**		 with older kernels (never smaps)
+**   pagestat()	 present pages of an area via /proc/self/pagemap
+**   nodestat()	 pages of an area per NUMA node via move_pages(2),
+**		 instead of parsing /proc/self/numa_maps
+**
+** pagestat() and nodestat() inspect at most 'budget' pages per call:
+** a larger area is sampled with evenly spread windows of consecutive
+** pages, and the counts are extrapolated to the whole area.  So the
+** cost per call is bounded regardless of the size of the area.  The
+** sampling adapts as well: the cost per page of previous calls is
+** measured, and fewer pages are inspected when a call would exceed
+** STATNSEC (e.g. when page table walks are slow on a busy system).
+** The files are opened once and buffers are reused; every function
+** should only be called by one thread at a time.
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+
+#include "usemem.h"
+
+// PROCMAP_QUERY is not defined by older kernel headers
+//
+#ifndef	PROCMAP_QUERY
+struct procmap_query {
+	uint64_t	size;
+	uint64_t	query_flags;
+	uint64_t	query_addr;
+	uint64_t	vma_start;
+	uint64_t	vma_end;
+	uint64_t	vma_flags;
+	uint64_t	vma_page_size;
+	uint64_t	vma_offset;
+	uint64_t	inode;
+	uint32_t	dev_major;
+	uint32_t	dev_minor;
+	uint32_t	vma_name_size;
+	uint32_t	build_id_size;
+	uint64_t	vma_name_addr;
+	uint64_t	build_id_addr;
+};
+
+#define	PROCMAP_QUERY			_IOWR('f', 17, struct procmap_query)
+#define	PROCMAP_QUERY_COVERING_OR_NEXT_VMA	0x10
+#endif
+
+#define	WINDOW		STATWINDOW	// consecutive pages per sample
+
+#define	PM_PRESENT	(1ULL << 63)
+
+static double	pmcost, mpcost;		// ns per page of pagemap/move_pages
+
+static int	procfd(const char *, int *, pid_t *);
+static long	windows(size_t, long, size_t *);
+static long	adapt(long, double);
+static void	measure(double *, unsigned long long, long);
+
+/*
+** read the totals of /proc/self/smaps_rollup (KiB, or -1 when absent)
+** returns -1 when the file is not available
+*/
+int rollup(struct rollup *ru)
+{
+	static int	fd = -1;
+	static pid_t	pid;
+	static struct {
+		char	*key;
+		size_t	offset;
+	} fields[] = {
+		{ "Rss:",		offsetof(struct rollup, rss)      },
+		{ "Anonymous:",		offsetof(struct rollup, anon)     },
+		{ "AnonHugePages:",	offsetof(struct rollup, anonhuge) },
+		{ "FilePmdMapped:",	offsetof(struct rollup, filepmd)  },
+		{ "Swap:",		offsetof(struct rollup, swap)     },
+		{ "Locked:",		offsetof(struct rollup, locked)   },
+	};
+	char		buf[4096], *s;
+	ssize_t		n, len = 0;
+	int		i;
+
+	for (i=0; i < sizeof fields / sizeof fields[0]; i++)
+		*(long long *)((char *)ru + fields[i].offset) = -1;
+
+	if (procfd("/proc/self/smaps_rollup", &fd, &pid) == -1)
+		return -1;
+
+	if (lseek(fd, 0, SEEK_SET) == -1)
+		return -1;
+
+	while (len < sizeof buf - 1 &&
+	       (n = read(fd, buf + len, sizeof buf - 1 - len)) > 0)
+		len += n;
+
+	buf[len] = '\0';
+
+	for (s = buf; *s; s += strcspn(s, "\n"), s += *s == '\n') {
+		for (i=0; i < sizeof fields / sizeof fields[0]; i++) {
+			if (strncmp(s, fields[i].key, strlen(fields[i].key)))
+				continue;
+
+			*(long long *)((char *)ru + fields[i].offset) =
+				strtoll(s + strlen(fields[i].key), NULL, 10);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+** count the mappings that overlap the given area
+** returns -1 on failure
+*/
+long vmacount(void *start, size_t length)
+{
+	static int		fd = -1;
+	static pid_t		pid;
+	struct procmap_query	q;
+	unsigned long		addr = (unsigned long)start,
+				end  = addr + length, lo, hi;
+	char			line[1024];
+	long			count = 0;
+	FILE			*fp;
+
+	if (procfd("/proc/self/maps", &fd, &pid) == -1)
+		return -1;
+
+	while (addr < end) {
+		memset(&q, 0, sizeof q);
+		q.size        = sizeof q;
+		q.query_flags = PROCMAP_QUERY_COVERING_OR_NEXT_VMA;
+		q.query_addr  = addr;
+
+		if (ioctl(fd, PROCMAP_QUERY, &q) == -1) {
+			if (count == 0 && errno != ENOENT)
+				break;		// not supported: scan below
+
+			return count;
+		}
+
+		if (q.vma_start >= end)
+			return count;
+
+		count++;
+		addr = q.vma_end;
+	}
+
+	if (addr >= end)
+		return count;
+
+	// kernel without PROCMAP_QUERY
+	//
+	if ( (fp = fopen("/proc/self/maps", "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof line, fp)) {
+		if (sscanf(line, "%lx-%lx", &lo, &hi) == 2 &&
+		    lo < end && hi > (unsigned long)start)
+			count++;
+	}
+
+	fclose(fp);
+
+	return count;
+}
+
+/*
+** determine the present bytes of an area from the page map,
+** inspecting at most budget pages
+** returns -1 on failure
+*/
+int pagestat(void *start, size_t length, long budget, struct pagestat *ps)
+{
+	static int		fd = -1;
+	static pid_t		pid;
+	uint64_t		ent[WINDOW];
+	long			pagesize = sysconf(_SC_PAGESIZE), nwin, w, i, n;
+	size_t			first = (unsigned long)start / pagesize,
+				npages, stride;
+	long long		present = 0, inspected = 0;
+	unsigned long long	t = nanotime();
+	double			sampled;
+
+	memset(ps, 0, sizeof *ps);
+
+	if (procfd("/proc/self/pagemap", &fd, &pid) == -1)
+		return -1;
+
+	npages = (length + pagesize - 1) / pagesize;
+	nwin   = windows(npages, adapt(budget, pmcost), &stride);
+
+	for (w=0; w < nwin; w++) {
+		n = npages - w * stride < WINDOW ? npages - w * stride : WINDOW;
+
+		n = pread(fd, ent, n * sizeof *ent,
+		          (first + w * stride) * sizeof *ent) / (long)sizeof *ent;
+
+		if (n <= 0)
+			return -1;
+
+		for (i=0; i < n; i++)
+			present += (ent[i] & PM_PRESENT) != 0;
+
+		inspected += n;
+	}
+
+	if (inspected == 0)
+		return 0;
+
+	measure(&pmcost, nanotime() - t, inspected);
+
+	// extrapolate (exact when all inspected pages are present)
+	//
+	sampled     = (double)inspected / npages;
+	ps->present = present * pagesize / sampled + 0.5;
+
+	return 0;
+}
+
+/*
+** determine the pages of an area per NUMA node (pages[node]),
+** inspecting at most budget pages; pages that are not present
+** are not counted
+** returns -1 on failure
+*/
+int nodestat(void *start, size_t length, long budget, long long *pages,
+             int maxnodes)
+{
+	static void	**addrs;
+	static int	*status;
+	static long	maxaddrs;
+	long			pagesize = sysconf(_SC_PAGESIZE), nwin, w, i,
+				n = 0;
+	size_t			npages, stride;
+	char			*p = start;
+	unsigned long long	t = nanotime();
+
+	memset(pages, 0, maxnodes * sizeof *pages);
+
+	npages = (length + pagesize - 1) / pagesize;
+	nwin   = windows(npages, adapt(budget, mpcost), &stride);
+
+	if (nwin * WINDOW > maxaddrs) {	// reuse arrays for next calls
+		free(addrs);
+		free(status);
+
+		addrs  = malloc(nwin * WINDOW * sizeof *addrs);
+		status = malloc(nwin * WINDOW * sizeof *status);
+
+		if (!addrs || !status) {
+			maxaddrs = 0;
+			return -1;
+		}
+
+		maxaddrs = nwin * WINDOW;
+	}
+
+	for (w=0; w < nwin; w++)
+		for (i=0; i < WINDOW && w * stride + i < npages; i++)
+			addrs[n++] = p + (w * stride + i) * pagesize;
+
+	if (syscall(SYS_move_pages, 0, n, addrs, NULL, status, 0) == -1)
+		return -1;
+
+	measure(&mpcost, nanotime() - t, n);
+
+	for (i=0; i < n; i++)
+		if (status[i] >= 0 && status[i] < maxnodes)
+			pages[status[i]]++;
+
+	for (i=0; i < maxnodes && n; i++)
+		pages[i] = pages[i] * npages / n;
+
+	return 0;
+}
+
+/*
+** open a proc file once per process (again in a forked child)
+** returns -1 on failure
+*/
+static int procfd(const char *path, int *fd, pid_t *pid)
+{
+	if (*fd != -1 && *pid == getpid())
+		return 0;
+
+	if (*fd != -1)
+		close(*fd);
+
+	*pid = getpid();
+	*fd  = open(path, O_RDONLY|O_CLOEXEC);
+
+	return *fd == -1 ? -1 : 0;
+}
+
+/*
+** divide an area of npages in windows of consecutive pages, spread
+** evenly when more than budget pages would have to be inspected
+** returns the number of windows (stride set to the distance in pages)
+*/
+static long windows(size_t npages, long budget, size_t *stride)
+{
+	long	nwin = (npages + WINDOW - 1) / WINDOW;
+
+	if (budget < WINDOW)
+		budget = WINDOW;
+
+	if (nwin * WINDOW > budget)
+		nwin = budget / WINDOW;
+
+	*stride = nwin > 1 ? (npages - WINDOW) / (nwin - 1) : 0;
+
+	if (*stride < WINDOW && nwin * WINDOW >= npages)
+		*stride = WINDOW;
+
+	return nwin;
+}
+
+/*
+** reduce the budget of pages when the measured cost per page
+** would make a call exceed STATNSEC
+*/
+static long adapt(long budget, double cost)
+{
+	if (cost > 0 && STATNSEC / cost < budget)
+		budget = STATNSEC / cost;
+
+	return budget;		// windows() inspects at least one window
+}
+
+/*
+** keep a moving average of the cost per page of a call
+*/
+static void measure(double *cost, unsigned long long ns, long pages)
+{
+	if (pages <= 0)
+		return;
+
+	*cost = *cost ? (*cost * 3 + (double)ns / pages) / 4 :
+	                (double)ns / pages;
+}
@@ -0,0 +1,247 @@
+/* swapin.c
+**
+** Measurement mode 'swapin': application-driven swap prefetch, compared
+** to synchronous swap-in by page faults
+**
+** Usage: usemem -x swapin [-o options] [-m|-s|-S] [flags] virtsize
+**
+**   The area of virtsize is referenced and paged out (as with flag -P),
+**   after which it is touched sequentially in chunks, like the keepalive
+**   loop does.  Without prefetch every page is swapped in synchronously
+**   by a page fault.  With prefetch a helper thread advises the chunks
+**   that are up to a distance ahead of the touch cursor with
+**   MADV_WILLNEED (asynchronous swap readahead) or MADV_POPULATE_READ
+**   (synchronous swap-in by the helper).  For every method the touch
+**   latency per chunk, the swap-in throughput and the major faults of
+**   the touching thread are shown.
+**
+** Options (-o):
+**   method=list	colon-separated methods (default none:willneed:populate)
+**   distance=sz	prefetch distance ahead of the cursor (default 8M)
+**   chunk=sz	unit of touching and prefetching (default 256K)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "usemem.h"
+
+#ifndef	MADV_PAGEOUT
+#define	MADV_PAGEOUT	0	// ignore if not supported
+#endif
+
+#ifndef	MADV_POPULATE_READ
+#define	MADV_POPULATE_READ	0	// ignore if not supported
+#endif
+
+#ifndef	RUSAGE_THREAD
+#define	RUSAGE_THREAD	1
+#endif
+
+struct prefetch {
+	char			*p;
+	long long		size, chunk, distance;
+	int			advice;
+	volatile long long	cursor;		// offset being touched
+	long long		ahead;		// offset prefetched until
+	long long		calls, failed;
+};
+
+static void		*prefetcher(void *);
+static void		swapinrun(struct uconf *, char *, const char *, long long,
+			          long long);
+
+int
+swapinmode(struct uconf *cf)
+{
+	char		*p, *msg, *methods, *m, item[16];
+	long long	chunk, distance;
+
+	methods  = strdup(modeopt(cf, "method") ? modeopt(cf, "method") :
+	                                          "none:willneed:populate");
+	chunk    = modeoptnum(cf, "chunk",    256*1024);
+	distance = modeoptnum(cf, "distance", 8*1024*1024);
+
+	chunk = (chunk + cf->pagesize - 1) / cf->pagesize * cf->pagesize;
+
+	if (chunk <= 0 || chunk > cf->virtual || distance < 0) {
+		fprintf(stderr, "invalid options for swapin mode\n");
+		return 1;
+	}
+
+	for (m = methods; *m; m += strcspn(m, ":"), m += *m == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(m, ":"), m);
+
+		if (strcmp(item, "none") && strcmp(item, "willneed") &&
+		    strcmp(item, "populate")) {
+			fprintf(stderr, "wrong method: %s\n", item);
+			return 1;
+		}
+
+		if (strcmp(item, "populate") == 0 && MADV_POPULATE_READ == 0) {
+			fprintf(stderr, "method populate not supported\n");
+			return 1;
+		}
+	}
+
+	if (procvalue("/proc/meminfo", "SwapTotal:") <= 0)
+		fprintf(stderr, "warning: no swap space configured\n");
+
+	if ( (p = allocmem(cf, cf->virtual, &msg)) == NULL) {
+		perror(msg);
+		return 1;
+	}
+
+	preadvise(cf, p, cf->virtual);
+
+	printf("%lld KiB (%s), chunk %lld KiB, prefetch distance %lld KiB\n",
+	       cf->virtual/1024, msg, chunk/1024, distance/1024);
+	printf("%-9s %9s %9s %10s %10s %10s %10s %9s %9s\n", "method",
+	       "paged out", "time ms", "MiB/s", "p50 us", "p99 us",
+	       "max us", "majflt", "pswpin");
+
+	for (m = methods; *m; m += strcspn(m, ":"), m += *m == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(m, ":"), m);
+		swapinrun(cf, p, item, chunk, distance);
+	}
+
+	return 0;
+}
+
+/*
+** reference and page out the area, and touch it again with the
+** given prefetch method
+*/
+static void swapinrun(struct uconf *cf, char *p, const char *method,
+                      long long chunk, long long distance)
+{
+	struct prefetch		pf;
+	pthread_t		tid;
+	unsigned long long	*lat, t, start;
+	long long		nchunks, i, off, swapin;
+	struct rusage		ru0, ru1;
+	struct pagestat		ps;
+	int			stat;
+
+	memset(p, 'X', cf->virtual);
+
+	TRACEPOINT(pageout_start, p, cf->virtual);
+	do_advise("pageout", MADV_PAGEOUT, p, cf->virtual);
+	TRACEPOINT(pageout_end, p, cf->virtual);
+
+	stat = pagestat(p, cf->virtual, STATPAGES, &ps);
+
+	nchunks = (cf->virtual + chunk - 1) / chunk;
+
+	if ( (lat = malloc(nchunks * sizeof *lat)) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	memset(&pf, 0, sizeof pf);
+	pf.p        = p;
+	pf.size     = cf->virtual;
+	pf.chunk    = chunk;
+	pf.distance = distance;
+	pf.advice   = strcmp(method, "willneed") == 0 ? MADV_WILLNEED :
+	                                                MADV_POPULATE_READ;
+
+	swapin = procvalue("/proc/vmstat", "pswpin");
+	getrusage(RUSAGE_THREAD, &ru0);
+	start  = nanotime();
+
+	if (strcmp(method, "none") && (errno = pthread_create(&tid, NULL,
+	                                       prefetcher, &pf)) ) {
+		perror("pthread_create");
+		exit(1);
+	}
+
+	// touch the area chunk by chunk
+	//
+	for (i=0, off=0; off < cf->virtual; i++, off += chunk) {
+		pf.cursor = off;
+		t = nanotime();
+		memset(p + off, 'Y', off + chunk > cf->virtual ?
+		                     cf->virtual - off : chunk);
+		lat[i] = nanotime() - t;
+	}
+
+	pf.cursor = cf->virtual;
+	t = nanotime() - start;
+
+	getrusage(RUSAGE_THREAD, &ru1);
+
+	if (strcmp(method, "none"))
+		pthread_join(tid, NULL);
+
+	swapin = procvalue("/proc/vmstat", "pswpin") - swapin;
+
+	latsort(lat, nchunks);
+
+	printf("%-9s ", method);
+
+	if (stat == 0)
+		printf("%8lld%% ", (cf->virtual - ps.present) * 100 /
+		                   cf->virtual);
+	else
+		printf("%9s ", "-");
+
+	printf("%9.1f %10.1f %10.1f %10.1f %10.1f %9ld %9lld\n",
+	       t / 1e6, cf->virtual / 1048576.0 / (t / 1e9),
+	       latpct(lat, nchunks, 50) / 1e3, latpct(lat, nchunks, 99) / 1e3,
+	       latpct(lat, nchunks, 100) / 1e3,
+	       ru1.ru_majflt - ru0.ru_majflt, swapin);
+
+	if (pf.failed)
+		printf("          (%lld of %lld prefetch advises failed)\n",
+		       pf.failed, pf.calls);
+
+	fflush(stdout);
+	free(lat);
+}
+
+/*
+** helper thread: advise the chunks that are within the
+** prefetch distance ahead of the touch cursor
+*/
+static void *prefetcher(void *arg)
+{
+	struct prefetch		*pf = arg;
+	struct timespec		pause = {0, 20000};
+	long long		len;
+
+	while (pf->ahead < pf->size && pf->cursor < pf->size) {
+		if (pf->ahead < pf->cursor)	// overtaken by the cursor
+			pf->ahead = pf->cursor;
+
+		if (pf->ahead >= pf->cursor + pf->chunk + pf->distance) {
+			nanosleep(&pause, NULL);
+			continue;
+		}
+
+		len = pf->ahead + pf->chunk > pf->size ?
+		      pf->size - pf->ahead : pf->chunk;
+
+		if (madvise(pf->p + pf->ahead, len, pf->advice) == -1)
+			pf->failed++;
+
+		pf->calls++;
+		pf->ahead += len;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,282 @@
+/* thpbloat.c
+**
+** Measurement mode 'thpbloat': memory bloat caused by transparent
+** huge pages for sparse touch patterns
+**
+** Usage: usemem -x thpbloat [-o options] virtsize
+**
+**   For every density, a fresh memory area of virtsize (rounded to
+**   2 MiB) is touched sparsely with THP advised (MADV_HUGEPAGE) and
+**   with THP disabled (MADV_NOHUGEPAGE).  The resident size is shown
+**   relative to the bytes actually touched.
+**
+**   Optionally the effect of khugepaged is measured: the area is touched
+**   with small pages, advised for THP afterwards and the resident size
+**   is followed while khugepaged collapses it, for each value of
+**   max_ptes_none to be tried.
+**
+** Options (-o):
+**   density=list	colon-separated densities: percentages of the pages
+**		in each 2 MiB, or '1p' for one page (default 1p:10:50)
+**   ptesnone=list	colon-separated values for khugepaged/max_ptes_none
+**		to measure collapses with (requires root; the original
+**		value is restored), or 'cur' for the current value
+**		(default: no collapse measurement)
+**   wait=sec	time to wait for khugepaged per measurement (default 60)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "usemem.h"
+
+#ifndef	MADV_HUGEPAGE
+#define	MADV_HUGEPAGE	0	// ignore if not supported
+#endif
+
+#ifndef	MADV_NOHUGEPAGE
+#define	MADV_NOHUGEPAGE	0	// ignore if not supported
+#endif
+
+#define	PTESNONE	"/sys/kernel/mm/transparent_hugepage/khugepaged/max_ptes_none"
+
+static long		pagesize;
+static size_t		size;
+static char		orgptes[32];
+static int		ptesset;	// max_ptes_none has been changed
+
+static long		touchpages(char *, char *);
+static void		bloat(char *, int);
+static void		collapse(char *, char *, int);
+static void		resetptes(void);
+static void		restoreptes(int);
+
+int
+thpbloatmode(struct uconf *cf)
+{
+	char	*densities, *ptesnone, *d, *n, item[32];
+	int	wait;
+
+	densities = strdup(modeopt(cf, "density") ? modeopt(cf, "density") :
+	                                            "1p:10:50");
+	ptesnone  = modeopt(cf, "ptesnone") ? strdup(modeopt(cf, "ptesnone")) :
+	                                      NULL;
+	wait      = modeoptnum(cf, "wait", 60);
+
+	pagesize  = cf->pagesize;
+	size      = (cf->virtual + HPAGESIZE - 1) / HPAGESIZE * HPAGESIZE;
+
+	if (cf->alloctype != 'a' && cf->alloctype != 'm')
+		fprintf(stderr, "warning: -%c flag ignored (mmap used)\n",
+		                cf->alloctype);
+
+	if (MADV_HUGEPAGE == 0 || MADV_NOHUGEPAGE == 0) {
+		fprintf(stderr, "THP advises not supported\n");
+		return 1;
+	}
+
+	// bloat at fault time with THP advised and disabled
+	//
+	printf("%-8s %-4s %14s %14s %14s %8s\n", "density", "THP",
+	       "touched KiB", "resident KiB", "AnonHuge KiB", "bloat");
+
+	for (d = densities; *d; d += strcspn(d, ":"), d += *d == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(d, ":"), d);
+		bloat(item, 1);
+		bloat(item, 0);
+	}
+
+	if (!ptesnone)
+		return 0;
+
+	// later collapses by khugepaged per value of max_ptes_none
+	//
+	if (readfile(PTESNONE, orgptes, sizeof orgptes) == -1) {
+		perror(PTESNONE);
+		return 1;
+	}
+
+	// the tunable is system-wide: restore it when interrupted
+	//
+	signal(SIGINT,  restoreptes);
+	signal(SIGTERM, restoreptes);
+
+	printf("\n%-8s %-8s %14s %14s %14s %8s %6s\n", "density",
+	       "ptesnone", "touched KiB", "before KiB", "after KiB",
+	       "bloat", "sec");
+
+	for (n = strtok(ptesnone, ":"); n; n = strtok(NULL, ":")) {
+		if (strcmp(n, "cur") == 0) {
+			n = orgptes;
+		} else {
+			ptesset = 1;
+
+			if (writefile(PTESNONE, "%s", n) == -1) {
+				perror("set max_ptes_none");
+				resetptes();
+				return 1;
+			}
+		}
+
+		for (d = densities; *d; d += strcspn(d, ":"), d += *d == ':') {
+			snprintf(item, sizeof item, "%.*s",
+			         (int)strcspn(d, ":"), d);
+			collapse(item, n, wait);
+		}
+	}
+
+	resetptes();
+
+	return 0;
+}
+
+/*
+** touch the pages of each huge page according to the density
+** and return the number of pages touched per huge page
+*/
+static long touchpages(char *p, char *density)
+{
+	long	perhuge = HPAGESIZE / pagesize, k, j;
+	char	*q;
+
+	if (strcmp(density, "1p") == 0)
+		k = 1;
+	else
+		k = perhuge * atoi(density) / 100;
+
+	if (k <= 0 || k > perhuge) {
+		fprintf(stderr, "wrong density: %s\n", density);
+		resetptes();
+		exit(1);
+	}
+
+	// spread the touched pages evenly over each huge page
+	//
+	for (q = p; q < p + size; q += HPAGESIZE)
+		for (j=0; j < k; j++)
+			q[j * perhuge / k * pagesize] = 'X';
+
+	return k;
+}
+
+/*
+** measure bloat at fault time for one density with or without THP
+*/
+static void bloat(char *density, int thp)
+{
+	char		*p;
+	long		k;
+	long long	huge0, touched;
+	struct pagestat	ps;
+
+	if ( (p = mapaligned(size, HPAGESIZE)) == NULL) {
+		perror("mmap");
+		exit(1);
+	}
+
+	do_advise(thp ? "-t" : "-n", thp ? MADV_HUGEPAGE : MADV_NOHUGEPAGE,
+	          p, size);
+
+	huge0    = procvalue("/proc/self/smaps_rollup", "AnonHugePages:");
+	k        = touchpages(p, density);
+	touched  = size / HPAGESIZE * k * pagesize;
+	(void) pagestat(p, size, STATPAGES, &ps);
+
+	printf("%-8s %-4s %14lld %14lld %14lld %7.1fx\n", density,
+	       thp ? "on" : "off", touched/1024, ps.present/1024,
+	       procvalue("/proc/self/smaps_rollup", "AnonHugePages:") - huge0,
+	       (double)ps.present / touched);
+	fflush(stdout);
+
+	munmap(p, size);
+}
+
+/*
+** measure the resident size while khugepaged collapses an area that
+** was touched sparsely with small pages
+*/
+static void collapse(char *density, char *ptesnone, int wait)
+{
+	char		*p;
+	long		k;
+	int		secs;
+	long long	touched, before, after = 0;
+	struct pagestat	ps;
+
+	if ( (p = mapaligned(size, HPAGESIZE)) == NULL) {
+		perror("mmap");
+		resetptes();
+		exit(1);
+	}
+
+	do_advise("-n", MADV_NOHUGEPAGE, p, size);
+
+	k       = touchpages(p, density);
+	touched = size / HPAGESIZE * k * pagesize;
+	(void) pagestat(p, size, STATPAGES, &ps);
+	before  = ps.present;
+
+	do_advise("-t", MADV_HUGEPAGE, p, size);
+
+	// follow the resident size until everything is
+	// collapsed or the wait time has passed
+	//
+	for (secs=0; secs < wait; secs++) {
+		sleep(1);
+		(void) pagestat(p, size, STATPAGES, &ps);
+
+		if ( (after = ps.present) == size)
+			break;
+	}
+
+	if (!after) {
+		(void) pagestat(p, size, STATPAGES, &ps);
+		after = ps.present;
+	}
+
+	printf("%-8s %-8s %14lld %14lld %14lld %7.1fx %6d\n", density,
+	       ptesnone, touched/1024, before/1024, after/1024,
+	       (double)after / touched, secs);
+	fflush(stdout);
+
+	munmap(p, size);
+}
+
+/*
+** restore the original value of max_ptes_none (when changed)
+*/
+static void resetptes(void)
+{
+	if (ptesset)
+		(void) writefile(PTESNONE, "%s", orgptes);
+
+	ptesset = 0;
+}
+
+/*
+** signal handler: restore max_ptes_none
+** (only async-signal-safe calls)
+*/
+static void restoreptes(int sig)
+{
+	int	fd;
+
+	if (ptesset && (fd = open(PTESNONE, O_WRONLY)) != -1) {
+		(void) write(fd, orgptes, strlen(orgptes));
+		close(fd);
+	}
+
+	_exit(1);
+}
@@ -0,0 +1,258 @@
+/* thpsplit.c
+**
+** Measurement mode 'thpsplit': split storm of transparent huge pages
+** caused by releasing or re-protecting small pieces of them
+**
+** Usage: usemem -x thpsplit [-o options] [-t] virtsize
+**
+**   The memory area of virtsize (rounded to 2 MiB) is allocated with
+**   mmap, advised for THP (flag -t) and populated completely.  Then
+**   a piece of each huge page is released or re-protected.
+**
+** Options (-o):
+**   op=name	munmap, dontneed (default) or mprotect (read-only)
+**   piece=sz	size of the piece per huge page (default 4K)
+**   offset=sz	offset of the piece in the huge page (default 1M)
+**   every=n	handle a piece in every n-th huge page (default 1)
+**   sweeps=n	number of read sweeps to measure TLB misses (default 3)
+**
+** Shown are the latency of the system calls, the THP split counters
+** of /proc/vmstat, the AnonHugePages of the process and the dTLB load
+** misses (when perf events are available) and time per page access of
+** a random-order sweep over the remaining pages, before and after.
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+
+#include "usemem.h"
+
+#ifndef	MADV_HUGEPAGE
+#define	MADV_HUGEPAGE	0	// ignore if not supported
+#endif
+
+#define	DTLBMISS	(PERF_COUNT_HW_CACHE_DTLB | \
+			 PERF_COUNT_HW_CACHE_OP_READ << 8 | \
+			 PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static char *counters[] = {
+	"thp_split_page", "thp_split_page_failed",
+	"thp_deferred_split_page", "thp_split_pmd",
+};
+
+#define	NCOUNTERS	(sizeof counters / sizeof counters[0])
+
+static long		*sweeplist;
+static long		nsweep;
+
+static void		buildsweep(long, long, long, long, long, int);
+static void		sweep(char *, int, int, char *);
+
+int
+thpsplitmode(struct uconf *cf)
+{
+	char			*p, *op;
+	long			piece, offset, every, npages, i, n = 0;
+	int			sweeps, perffd;
+	long long		cnt0[NCOUNTERS], huge0;
+	unsigned long long	*lat, t, total = 0;
+	size_t			size;
+
+	op     = modeopt(cf, "op");
+	piece  = modeoptnum(cf, "piece",  cf->pagesize);
+	offset = modeoptnum(cf, "offset", HPAGESIZE/2);
+	every  = modeoptnum(cf, "every",  1);
+	sweeps = modeoptnum(cf, "sweeps", 3);
+
+	if (!op)
+		op = "dontneed";
+
+	if (strcmp(op, "munmap") && strcmp(op, "dontneed") && strcmp(op, "mprotect")) {
+		fprintf(stderr, "op must be munmap, dontneed or mprotect\n");
+		return 1;
+	}
+
+	if (piece <= 0 || piece % cf->pagesize || offset < 0 ||
+	    offset % cf->pagesize || offset + piece > HPAGESIZE ||
+	    piece == HPAGESIZE || every <= 0) {
+		fprintf(stderr, "piece and offset must be page-aligned "
+		                "within one huge page\n");
+		return 1;
+	}
+
+	if (sweeps <= 0) {
+		fprintf(stderr, "invalid options for thpsplit mode\n");
+		return 1;
+	}
+
+	if (cf->alloctype != 'a' && cf->alloctype != 'm')
+		fprintf(stderr, "warning: -%c flag ignored (mmap used)\n",
+		                cf->alloctype);
+
+	if (cf->hflag)
+		fprintf(stderr, "warning: -h flag ignored (THP used)\n");
+
+	if (!cf->tflag)
+		fprintf(stderr, "warning: without -t huge pages are only "
+		                "used when THP is enabled 'always'\n");
+
+	// allocate memory aligned on huge page size
+	//
+	size   = (cf->virtual + HPAGESIZE - 1) / HPAGESIZE * HPAGESIZE;
+	npages = size / HPAGESIZE;
+
+	if ( (p = mapaligned(size, HPAGESIZE)) == NULL) {
+		perror("mmap");
+		return 1;
+	}
+
+	if (cf->tflag)
+		do_advise("-t", MADV_HUGEPAGE, p, size);
+
+	memset(p, 'X', size);
+
+	if ( (lat = malloc(npages * sizeof *lat)) == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%ld KiB populated at address %p, AnonHugePages %lld KiB\n",
+	       (long)size/1024, p,
+	       procvalue("/proc/self/smaps_rollup", "AnonHugePages:"));
+
+	// measure TLB misses before splitting
+	//
+	perffd = perfopen(PERF_TYPE_HW_CACHE, DTLBMISS);
+
+	buildsweep(size, offset, piece, every, cf->pagesize, 0);
+	sweep(p, sweeps, perffd, "before");
+
+	// release or protect a piece of each huge page
+	//
+	for (i=0; i < NCOUNTERS; i++)
+		cnt0[i] = procvalue("/proc/vmstat", counters[i]);
+
+	huge0 = procvalue("/proc/self/smaps_rollup", "AnonHugePages:");
+
+	for (i=0; i < npages; i += every) {
+		char	*q = p + i * HPAGESIZE + offset;
+
+		t = nanotime();
+
+		switch (*op) {
+		   case 'm':
+			if (op[1] == 'u')
+				(void) munmap(q, piece);
+			else
+				(void) mprotect(q, piece, PROT_READ);
+			break;
+
+		   case 'd':
+			(void) madvise(q, piece, MADV_DONTNEED);
+			break;
+		}
+
+		lat[n]  = nanotime() - t;
+		total  += lat[n++];
+	}
+
+	latsort(lat, n);
+
+	printf("%ld x %s of %ld KiB: latency avg %llu ns, p50 %llu ns, "
+	       "p99 %llu ns, max %llu ns\n",
+	       n, op, piece/1024, total / n, latpct(lat, n, 50),
+	       latpct(lat, n, 99), lat[n-1]);
+
+	for (i=0; i < NCOUNTERS; i++)
+		printf("%s +%lld ", counters[i],
+		       procvalue("/proc/vmstat", counters[i]) - cnt0[i]);
+
+	printf("\nAnonHugePages %lld KiB -> %lld KiB\n", huge0,
+	       procvalue("/proc/self/smaps_rollup", "AnonHugePages:"));
+
+	// measure TLB misses after splitting, skipping the pieces
+	//
+	buildsweep(size, offset, piece, every, cf->pagesize, 1);
+	sweep(p, sweeps, perffd, "after");
+
+	return 0;
+}
+
+/*
+** build a random-order list of page offsets to be accessed
+** by a sweep, optionally skipping the handled pieces
+*/
+static void buildsweep(long size, long offset, long piece, long every,
+                       long pagesize, int skip)
+{
+	long	i, j, off, tmp;
+
+	free(sweeplist);
+	sweeplist = malloc(size / pagesize * sizeof *sweeplist);
+	nsweep    = 0;
+
+	if (!sweeplist) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (off=0; off < size; off += pagesize) {
+		if (skip && (off / HPAGESIZE) % every == 0 &&
+		    off % HPAGESIZE >= offset && off % HPAGESIZE < offset + piece)
+			continue;
+
+		sweeplist[nsweep++] = off;
+	}
+
+	for (i=nsweep-1; i > 0; i--) {
+		j            = random() % (i + 1);
+		tmp          = sweeplist[i];
+		sweeplist[i] = sweeplist[j];
+		sweeplist[j] = tmp;
+	}
+}
+
+/*
+** read one byte of each page in the sweep list and show
+** the dTLB misses and the time per access
+*/
+static void sweep(char *p, int sweeps, int perffd, char *label)
+{
+	volatile char		sum = 0;
+	unsigned long long	t;
+	long long		misses;
+	long			i;
+	int			s;
+
+	t = nanotime();
+	perfstart(perffd);
+
+	for (s=0; s < sweeps; s++)
+		for (i=0; i < nsweep; i++)
+			sum += p[sweeplist[i]];
+
+	misses = perfstop(perffd);
+	t      = nanotime() - t;
+
+	printf("sweep %-6s: %.1f ns per page access", label,
+	       (double)t / (sweeps * nsweep));
+
+	if (misses >= 0)
+		printf(", %.3f dTLB misses per page access",
+		       (double)misses / (sweeps * nsweep));
+	else
+		printf(", dTLB misses not available");
+
+	printf("\n");
+}
@@ -2,12 +2,17 @@
 **
 ** Force well-defined utilization of memory
 **
-** Usage: usemem [-m|-s|-S] [-t|-n] [-M] [-hl] [-r seconds] virtsz [physsz [alivesz]]
+** Usage: usemem [-m|-s|-S|-F path|-H] [-t|-n] [-M] [-hl] [-r seconds [-L]] virtsz [physsz [alivesz]]
+**        usemem -x mode [-o options] [flags] virtsz [physsz [alivesz]]
 **
 ** Flags:
 **   -m		use mmap to allocate (default: malloc)
 **   -s		create as Posix shared memory
 **   -S		create as System V shared memory
+**   -F path	map a file on hugetlbfs, preallocated with fallocate
+**		(see hugetlbfs.c for the meaning of path)
+**   -H		mmap with huge pages per chunk, falling back from 1 GiB
+**		hugetlb to 2 MiB hugetlb, THP and base pages (see hugemix.c)
 **
 **   -t		advise to use transparent huge pages
 **   -n		advise not to use transparent huge pages
@@ -20,11 +25,22 @@
 **   -h		use huge pages (not for malloc or Posix IPC)
 **   -l		lock memory
 **
+**   -r sec	repeat allocation every <sec> seconds
+**   -L		project time until memory limits are reached (with -r)
+**
+**   -x mode	run measurement mode (see table modes[] below), which
+**		interprets the sizes in its own way (see its source file)
+**   -o opts	comma-separated options for the mode as key=value
+**
 **   virtsz 	requested memory
 **   physsz 	referenced memory (once)
 **   alivesz	referenced memory (each second)
 **
 ** All sizes can be extended with [KMGT]
+**
+** Phase boundaries (allocation, reference, advise, lock, repetition and
+** keepalive tick) are written to the ftrace trace_marker and are available
+** as USDT probes (see TRACEPOINT in usemem.h).
 ** ==========================================================================
 ** Author:       JC van Winkel		original version based on malloc
 **
@@ -55,6 +71,8 @@
 #include <sys/shm.h>
 #include <ctype.h>
 
+#include "usemem.h"
+
 #ifndef	MADV_HUGEPAGE
 #define	MADV_HUGEPAGE	0	// ignore if not supported
 #endif
@@ -79,8 +97,60 @@
 #define	MADV_POPULATE_WRITE	0	// ignore if not supported
 #endif
 
-static long long	getnum(const char *);
-static void		do_advise(char *, int, void *, size_t);
+static void		checkopts(struct uconf *, struct umode *);
+
+/*
+** measurement modes
+*/
+static struct umode	modes[] = {
+	{ "stack",	stackmode,	"threads,frame,spread,active,interval",
+	  "thread stacks (virtsize per stack, physsize touched depth)" },
+	{ "damon",	damonmode,	"sample,aggr,update,minregions,maxregions,"
+					"hotdelay,interval,count",
+	  "validate access pattern (alive/referenced) with DAMON" },
+	{ "thpsplit",	thpsplitmode,	"op,piece,offset,every,sweeps",
+	  "THP split storm by partial release/protection of huge pages" },
+	{ "thpbloat",	thpbloatmode,	"density,ptesnone,wait",
+	  "THP memory bloat for sparse touch patterns (and khugepaged)" },
+	{ "cgdepth",	cgdepthmode,	"cgroup,depths,runs,rounds,statreads",
+	  "memory cgroup charging overhead per nesting depth" },
+	{ "memhigh",	memhighmode,	"cgroup,step,below,steps,rounds",
+	  "throttling penalty curve above memory.high (physsize high)" },
+	{ "dirty",	dirtymode,	"file,rate,batch,msync,async,stall,duration",
+	  "writeback throttling stalls for a file-backed area" },
+	{ "ring",	ringmode,	"msg,count,pings,pairs,place",
+	  "shared memory ring buffer IPC throughput and latency" },
+	{ "density",	densitymode,	"procs,interval,duration",
+	  "kernel overhead of thousands of small processes" },
+	{ "pollute",	pollutemode,	"cache,pct,stride,rate,write,cpu,"
+					"interval,duration",
+	  "noisy neighbor evicting L2/LLC cache lines at a given rate" },
+	{ "swapin",	swapinmode,	"method,distance,chunk",
+	  "swap prefetch (MADV_WILLNEED/POPULATE_READ) versus faults" },
+	{ "pgalloc",	pgallocmode,	"threads,op,duration",
+	  "page allocator scalability (virtsize chunk per cycle)" },
+	{ "soak",	soakmode,	"period,chunk,churn,keep,duration",
+	  "long-duration run with periodic aggregates and drift detection" },
+	{ "zeropage",	zeropagemode,	"thp",
+	  "read faults mapping the (huge) zero page and CoW cost" },
+	{ "intensity",	intensitymode,	"ops,unit,random,rounds",
+	  "compute/memory mix with tunable arithmetic intensity" },
+	{ "clients",	clientsmode,	"clients,threads,think,req,pattern,"
+					"duration",
+	  "many clients with own working sets as coroutines" },
+	{ "kv",		kvmode,		"role,socket,objsize,objects,clients,"
+					"requests,setpct",
+	  "key-value server on a Unix socket with load generator" },
+	{ "save",	savemode,	"file,io,threads,chunk",
+	  "save the referenced area to a snapshot file" },
+	{ "restore",	restoremode,	"file,method,threads,chunk,cached",
+	  "restore time-to-ready from a snapshot file per method" },
+	{ "numabal",	numabalmode,	"threads,from,to,switch,duration,interval",
+	  "NUMA balancing convergence after threads move to another node" },
+	{ "exectext",	exectextmode,	"file,text,dir,prot,thp,run,steps,"
+					"interval",
+	  "refaults and fetch latency of program text under anon pressure" },
+};
 
 void
 conflict(char f1, char f2)
@@ -95,10 +165,12 @@ main(int argc, char *argv[])
 	char 		*p, *msg;
 	char		alloctype = 'a';
 	char		tflag = 0, nflag = 0, hflag = 0, lflag = 0, Mflag = 0,
-			Cflag = 0, Pflag = 0, Rflag = 0, Wflag = 0;
-	int		i, c, opts, fd, flags=0;
+			Cflag = 0, Pflag = 0, Rflag = 0, Wflag = 0, Lflag = 0;
+	char		*modeopts = NULL, *hugetlbfs = NULL;
+	struct umode	*mode = NULL;
+	struct uconf	cf;
+	int		i, c;
 	long		pagesize = sysconf(_SC_PAGESIZE), repeatinterval = -1;
-	long long 	j;
 	long long 	virtual = 0;
 	long long 	physical = 0;
 	long long 	keepalive = 0;
@@ -107,12 +179,19 @@ main(int argc, char *argv[])
 	//
 	if (argc < 2) {
 		fprintf(stderr,
-		        "Usage: usemem [-m|-s|-S] [-t|-n] [-MCPRW] [-hl] "
-			"[-r sec] virtsize [physsize [alivesize]]\n");
+		        "Usage: usemem [-m|-s|-S|-F path|-H] [-t|-n] [-MCPRW] [-hl] "
+			"[-r sec [-L]] virtsize [physsize [alivesize]]\n");
+		fprintf(stderr,
+		        "       usemem -x mode [-o key=val,...] [flags] "
+			"virtsize [physsize [alivesize]]\n");
 		fprintf(stderr, "\tflags:\n");
 		fprintf(stderr, "\t\t-m\tuse mmap to allocate (default: malloc)\n");
 		fprintf(stderr, "\t\t-s\tcreate as Posix shared memory\n");
-		fprintf(stderr, "\t\t-S\tcreate as System V shared memory\n\n");
+		fprintf(stderr, "\t\t-S\tcreate as System V shared memory\n");
+		fprintf(stderr, "\t\t-F path\tmap a file on hugetlbfs (path: file, "
+		                "directory or page size)\n");
+		fprintf(stderr, "\t\t-H\tmmap with huge page fallback (1G, 2M, "
+		                "THP, base pages)\n\n");
 
 		fprintf(stderr, "\t\t-t\tadvise to use transparent huge pages\n");
 		fprintf(stderr, "\t\t-n\tadvise not to use transparent huge pages\n");
@@ -124,7 +203,16 @@ main(int argc, char *argv[])
 
 		fprintf(stderr, "\t\t-h\tuse huge pages (not for malloc or Posix IPC)\n");
 		fprintf(stderr, "\t\t-l\tlock memory\n\n");
-		fprintf(stderr, "\t\t-r sec\trepeat allocation every <sec> seconds\n\n");
+		fprintf(stderr, "\t\t-r sec\trepeat allocation every <sec> seconds\n");
+		fprintf(stderr, "\t\t-L\tproject time until memory limits are "
+		                "reached (with -r)\n\n");
+		fprintf(stderr, "\t\t-x mode\trun measurement mode:\n");
+
+		for (i=0; i < sizeof modes / sizeof modes[0]; i++)
+			fprintf(stderr, "\t\t\t  %-10s %s\n",
+			                modes[i].name, modes[i].descr);
+
+		fprintf(stderr, "\t\t-o opts\toptions for measurement mode\n\n");
 
 		fprintf(stderr, "\tvirtsize \trequested memory\n");
 		fprintf(stderr, "\tphyssize \treferenced memory (once)\n");
@@ -135,7 +223,7 @@ main(int argc, char *argv[])
 
 	// verify flags
 	// 
-	while ((c=getopt(argc, argv, "msStnMCPRWhlr:")) != EOF) {
+	while ((c=getopt(argc, argv, "msSF:HtnMCPRWhlr:Lx:o:")) != EOF) {
 		switch (c) {
 		   case 'm':
 			if (alloctype != 'a') 
@@ -158,6 +246,22 @@ main(int argc, char *argv[])
 				alloctype = 'S';
 			break;
 
+		   case 'F':
+			if (alloctype != 'a') 
+				conflict(alloctype, c);
+			else
+				alloctype = 'F';
+
+			hugetlbfs = optarg;
+			break;
+
+		   case 'H':
+			if (alloctype != 'a') 
+				conflict(alloctype, c);
+			else
+				alloctype = 'H';
+			break;
+
 		   case 't':
 			tflag = 1;
 			break;
@@ -203,6 +307,28 @@ main(int argc, char *argv[])
 			}
 			break;
 
+		   case 'L':
+			Lflag = 1;
+			break;
+
+		   case 'x':
+			for (i=0; i < sizeof modes / sizeof modes[0]; i++) {
+				if (strcmp(optarg, modes[i].name) == 0) {
+					mode = &modes[i];
+					break;
+				}
+			}
+
+			if (!mode) {
+ 				fprintf(stderr, "wrong mode: %s\n", optarg);
+				exit(1);
+			}
+			break;
+
+		   case 'o':
+			modeopts = optarg;
+			break;
+
 		   default:
  			fprintf(stderr, "wrong flag: %c\n", c);
 			exit(1);
@@ -244,103 +370,56 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
-	// potential allocation loop
-	// (just once in case no repetition is required)
+	cf.alloctype		= alloctype;
+	cf.tflag		= tflag;
+	cf.nflag		= nflag;
+	cf.hflag		= hflag;
+	cf.lflag		= lflag;
+	cf.Mflag		= Mflag;
+	cf.Cflag		= Cflag;
+	cf.Pflag		= Pflag;
+	cf.Rflag		= Rflag;
+	cf.Wflag		= Wflag;
+	cf.pagesize		= pagesize;
+	cf.repeatinterval	= repeatinterval;
+	cf.virtual		= virtual;
+	cf.physical		= physical;
+	cf.keepalive		= keepalive;
+	cf.modeopts		= modeopts;
+	cf.hugetlbfs		= hugetlbfs;
+
+	// pass control to measurement mode
 	//
-	while (1) {
-		// allocate memory virtually
-		//
-		switch (alloctype) {
-
-	   	   // conventional malloc
-	   	   //
-		   case 'a':
-			if (hflag)
-				fprintf(stderr, "warning: -h flag ignored for malloc\n");
-
-			msg = "malloc";
-
-			if (tflag+nflag+Mflag+Cflag+Pflag+Rflag+Wflag+lflag) {
-				// start address must be page-aligned
-				p = malloc(virtual+pagesize);
-				if (!p)
-					break;
-
-				if ((unsigned long long)p % pagesize)
-					p = (char *)(((unsigned long long)p / pagesize + 1) * pagesize);
-			} else {
-				p = malloc(virtual);
-			}
-			
-			break;
-
-		   // mmap anonymous
-		   //
-		   case 'm':
-			opts = MAP_PRIVATE|MAP_ANONYMOUS;
-
-			if (hflag)
-				opts |= MAP_HUGETLB;
-		
-			msg = "mmap";
-			p = mmap(NULL, virtual, PROT_READ|PROT_WRITE, opts, -1, 0);
-			if (p == MAP_FAILED)
-				p = 0;
-
-			break;
-
-		   // Posix IPC with mmap shared
-		   //
-		   case 's':
-			opts = MAP_SHARED;
-	
-			if (hflag)
-				fprintf(stderr, "warning: -h flag ignored for Posix IPC\n");
-		
-			msg = "shm_open";
-			fd = shm_open("/shmtmp", O_RDWR|O_CREAT, 0600);
-		
-			if (fd == -1) {
-				p = 0;
-				break;
-			}
-		
-       		 	shm_unlink("/shmtmp");	// destroy when detached
+	if (mode) {
+		if (Lflag)
+			conflict('x', 'L');
 
-			msg = "ftruncate for Posix IPC";
-			if ( ftruncate(fd, virtual) == -1 ) {
-				p = 0;
-				break;
-			}
-
-			msg = "mmap for Posix IPC";
-			p = mmap(NULL, virtual, PROT_READ|PROT_WRITE, opts, fd, 0);
-			if (p == MAP_FAILED)
-				p = 0;
+		checkopts(&cf, mode);
 
-			close(fd);
+		exit(mode->func(&cf));
+	}
 
-			break;
+	if (modeopts) {
+		fprintf(stderr, "flag -o can only be used with -x\n");
+		exit(1);
+	}
 
-		   // System V IPC 
-		   //
-		   case 'S':
-			msg = "shmget";
-       			i = shmget(IPC_PRIVATE, virtual, IPC_CREAT |
-				(hflag ? SHM_HUGETLB : 0) | 0600);
-		
-			if (i == -1) {
-				p = 0;
-				break;
-			}
-		
-			msg = "shmat";
-			p = shmat(i, NULL, 0);
+	if (Lflag) {
+		if (repeatinterval == -1) {
+			fprintf(stderr, "flag -L can only be used with -r\n");
+			exit(1);
+		}
 
-			(void) shmctl(i, IPC_RMID, 0);	// destroy when detached
+		leakinit();
+	}
 
-			break;
-		}
+	// potential allocation loop
+	// (just once in case no repetition is required)
+	//
+	while (1) {
+		// allocate memory virtually
+		//
+		p = allocmem(&cf, virtual, &msg);
 
 		// verify success of previous allocation
 		//
@@ -350,25 +429,9 @@ main(int argc, char *argv[])
 		}
 
 		// handle advises before referencing memory
+		// and lock memory area
 		//
-		if (tflag)
-			do_advise("-t", MADV_HUGEPAGE, p, virtual);
-
-		if (nflag)
-			do_advise("-n", MADV_NOHUGEPAGE, p, virtual);
-	
-		if (Mflag)
-			do_advise("-M", MADV_MERGEABLE, p, virtual);
- 
-
-		// mlock memory area
-		//
-		if (lflag) {
-			if ( mlock(p, virtual) == -1 )
-				perror("warning: mlock failed");
-			else
-				printf("memory locked\n");
-		}
+		preadvise(&cf, p, virtual);
 
 		printf("%lld KiB allocated (%s) at address %p", virtual/1024, msg, p);
 		fflush(stdout);
@@ -376,25 +439,28 @@ main(int argc, char *argv[])
 		// reference memory physically
 		//
 		if (physical) {
+			TRACEPOINT(reference_start, p, physical);
 			memset(p, 'X', physical);
+			TRACEPOINT(reference_end, p, physical);
+
 			printf(" / %lld KiB referenced", physical/1024);
 			fflush(stdout);
+
+			if (alloctype == 'F') {
+				printf("\n");
+				hugetlbfsstat();
+			}
+
+			if (alloctype == 'H') {
+				printf("\n");
+				hugemixstat();
+			}
 		}
 
 		// handle advises after referencing memory
 		//
-		if (Rflag)
-			do_advise("-R", MADV_POPULATE_READ, p, virtual);
- 
-		if (Wflag)
-			do_advise("-W", MADV_POPULATE_WRITE, p, virtual);
- 
-		if (Cflag)
-			do_advise("-C", MADV_COLD, p, virtual);
- 
-		if (Pflag)
-			do_advise("-P", MADV_PAGEOUT, p, virtual);
- 
+		postadvise(&cf, p, virtual);
+
 		//
 		// verify if repetition is required (simulating memory leakage)
 		//
@@ -402,8 +468,13 @@ main(int argc, char *argv[])
 			break;
 		} else {
 			printf("\n");
+
+			if (Lflag)
+				leaksample();
+
 			fflush(stdout);
 			sleep(repeatinterval);
+			TRACEPOINT(repeat, p, virtual);
 		}
 	} 
 
@@ -415,6 +486,7 @@ main(int argc, char *argv[])
 
 	 	for (;;) {
 	   		sleep(1);
+			TRACEPOINT(keepalive_tick, p, keepalive);
 			memset(p, 'X', keepalive);
 		}
 	} else {
@@ -424,7 +496,197 @@ main(int argc, char *argv[])
 	}
 }
 
-static void do_advise(char *flag, int advice, void *start, size_t length)
+/*
+** allocate memory virtually according to the memory type
+** returns NULL on failure with msg referring to the failing call
+*/
+char *allocmem(struct uconf *cf, long long size, char **msg)
+{
+	char	*p = 0;
+	int	i, fd, opts;
+
+	TRACEPOINT(alloc_start, cf->alloctype, size);
+
+	switch (cf->alloctype) {
+
+	   // conventional malloc
+	   //
+	   case 'a':
+		if (cf->hflag)
+			fprintf(stderr, "warning: -h flag ignored for malloc\n");
+
+		*msg = "malloc";
+
+		if (cf->tflag+cf->nflag+cf->Mflag+cf->Cflag+cf->Pflag+
+		    cf->Rflag+cf->Wflag+cf->lflag) {
+			// start address must be page-aligned
+			p = malloc(size+cf->pagesize);
+			if (!p)
+				break;
+
+			if ((unsigned long long)p % cf->pagesize)
+				p = (char *)(((unsigned long long)p / cf->pagesize + 1) * cf->pagesize);
+		} else {
+			p = malloc(size);
+		}
+
+		break;
+
+	   // mmap anonymous
+	   //
+	   case 'm':
+		opts = MAP_PRIVATE|MAP_ANONYMOUS;
+
+		if (cf->hflag)
+			opts |= MAP_HUGETLB;
+
+		*msg = "mmap";
+		p = mmap(NULL, size, PROT_READ|PROT_WRITE, opts, -1, 0);
+		if (p == MAP_FAILED)
+			p = 0;
+
+		break;
+
+	   // Posix IPC with mmap shared
+	   //
+	   case 's':
+		opts = MAP_SHARED;
+
+		if (cf->hflag)
+			fprintf(stderr, "warning: -h flag ignored for Posix IPC\n");
+
+		*msg = "shm_open";
+		fd = shm_open("/shmtmp", O_RDWR|O_CREAT, 0600);
+
+		if (fd == -1)
+			break;
+
+		shm_unlink("/shmtmp");	// destroy when detached
+
+		*msg = "ftruncate for Posix IPC";
+		if ( ftruncate(fd, size) == -1 ) {
+			close(fd);
+			break;
+		}
+
+		*msg = "mmap for Posix IPC";
+		p = mmap(NULL, size, PROT_READ|PROT_WRITE, opts, fd, 0);
+		if (p == MAP_FAILED)
+			p = 0;
+
+		close(fd);
+
+		break;
+
+	   // System V IPC
+	   //
+	   case 'S':
+		*msg = "shmget";
+		i = shmget(IPC_PRIVATE, size, IPC_CREAT |
+			(cf->hflag ? SHM_HUGETLB : 0) | 0600);
+
+		if (i == -1)
+			break;
+
+		*msg = "shmat";
+		p = shmat(i, NULL, 0);
+		if (p == (char *)-1)
+			p = 0;
+
+		(void) shmctl(i, IPC_RMID, 0);	// destroy when detached
+
+		break;
+
+	   // file on hugetlbfs
+	   //
+	   case 'F':
+		if (cf->hflag)
+			fprintf(stderr, "warning: -h flag implied for hugetlbfs\n");
+
+		p = hugetlbfsalloc(cf, size, msg);
+		break;
+
+	   // mmap with huge page fallback chain
+	   //
+	   case 'H':
+		if (cf->hflag)
+			fprintf(stderr, "warning: -h flag implied for -H\n");
+
+		p = hugemixalloc(cf, size, msg);
+		break;
+	}
+
+	TRACEPOINT(alloc_end, p, size);
+
+	return p;
+}
+
+/*
+** release memory that was allocated by allocmem()
+** (not for malloc: the start address might have been aligned)
+*/
+void freemem(struct uconf *cf, char *p, long long size)
+{
+	switch (cf->alloctype) {
+	   case 'm':
+	   case 's':
+	   case 'H':
+		(void) munmap(p, size);
+		break;
+
+	   case 'F':
+		(void) munmap(p, hugetlbfssize(size));
+		break;
+
+	   case 'S':
+		(void) shmdt(p);
+		break;
+	}
+}
+
+/*
+** handle advises before referencing memory and lock memory area
+*/
+void preadvise(struct uconf *cf, char *p, long long size)
+{
+	if (cf->tflag)
+		do_advise("-t", MADV_HUGEPAGE, p, size);
+
+	if (cf->nflag)
+		do_advise("-n", MADV_NOHUGEPAGE, p, size);
+
+	if (cf->Mflag)
+		do_advise("-M", MADV_MERGEABLE, p, size);
+
+	if (cf->lflag) {
+		TRACEPOINT(lock, p, size);
+
+		if ( mlock(p, size) == -1 )
+			perror("warning: mlock failed");
+		else
+			printf("memory locked\n");
+	}
+}
+
+/*
+** handle advises after referencing memory
+*/
+void postadvise(struct uconf *cf, char *p, long long size)
+{
+	if (cf->Rflag)
+		do_advise("-R", MADV_POPULATE_READ, p, size);
+
+	if (cf->Wflag)
+		do_advise("-W", MADV_POPULATE_WRITE, p, size);
+
+	if (cf->Cflag)
+		do_advise("-C", MADV_COLD, p, size);
+
+	if (cf->Pflag)
+		do_advise("-P", MADV_PAGEOUT, p, size);
+}
+
+void do_advise(char *flag, int advice, void *start, size_t length)
 {
 	if (advice == 0) {
 		fprintf(stderr, "warning: advise %s not supported (ignored)\n",
@@ -432,17 +694,21 @@ static void do_advise(char *flag, int advice, void *start, size_t length)
 		return;
 	}
 
+	TRACEPOINT(advise_start, start, advice);
+
 	if (madvise(start, length, advice) == -1) {
 		fprintf(stderr, "warning: advise %s", flag);
 		perror(" advise failed (ignored)");
 	}
+
+	TRACEPOINT(advise_end, start, advice);
 }
 
 
 /*
 ** convert requested memory size to number of bytes
 */
-static long long getnum(const char *s)
+long long getnum(const char *s)
 {
 	long long 	n;
 	char 		*endptr;
@@ -473,3 +739,101 @@ static long long getnum(const char *s)
 
 	return n;
 }
+
+/*
+** obtain the value of an option of the measurement mode (flag -o)
+** returns NULL when the option is not specified and an empty string
+** when the option is specified without value
+*/
+char *modeopt(struct uconf *cf, const char *key)
+{
+	static char	value[256];
+	char		*s = cf->modeopts;
+	size_t		keylen = strlen(key), vallen;
+
+	while (s && *s) {
+		if (strncmp(s, key, keylen) == 0 &&
+		    (s[keylen] == '=' || s[keylen] == ',' || s[keylen] == 0)) {
+			s     += keylen;
+			s     += *s == '=';
+			vallen = strcspn(s, ",");
+
+			if (vallen >= sizeof value)
+				vallen = sizeof value - 1;
+
+			memcpy(value, s, vallen);
+			value[vallen] = 0;
+			return value;
+		}
+
+		if ( (s = strchr(s, ',')) )
+			s++;
+	}
+
+	return NULL;
+}
+
+/*
+** obtain the numeric value of an option of the measurement mode,
+** possibly extended with [KMGT] (zero is allowed here)
+*/
+long long modeoptnum(struct uconf *cf, const char *key, long long defvalue)
+{
+	char		*s, *endptr;
+	long long	n;
+
+	if ( (s = modeopt(cf, key)) == NULL)
+		return defvalue;
+
+	n = strtoll(s, &endptr, 10);
+
+	switch (toupper(*endptr)) {
+	   case 'T':
+		n *= 1024;
+	   case 'G':
+		n *= 1024;
+	   case 'M':
+		n *= 1024;
+	   case 'K':
+		n *= 1024;
+		endptr++;
+	}
+
+	if (endptr == s || *endptr) {
+		fprintf(stderr, "wrong value for option %s: %s\n", key, s);
+		exit(1);
+	}
+
+	return n;
+}
+
+/*
+** verify that all options of flag -o are known by the measurement mode
+*/
+static void checkopts(struct uconf *cf, struct umode *mode)
+{
+	char	*s = cf->modeopts, *k;
+	size_t	keylen;
+
+	while (s && *s) {
+		keylen = strcspn(s, "=,");
+
+		for (k = mode->optkeys; k && *k; k += strcspn(k, ",")) {
+			k += *k == ',';
+
+			if (strncmp(k, s, keylen) == 0 &&
+			    (k[keylen] == ',' || k[keylen] == 0))
+				break;
+		}
+
+		if (!k || !*k) {
+			fprintf(stderr, "wrong option for mode %s: %.*s "
+			                "(valid: %s)\n",
+			                mode->name, (int)keylen, s, mode->optkeys);
+			exit(1);
+		}
+
+		if ( (s = strchr(s, ',')) )
+			s++;
+	}
+}
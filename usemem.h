@@ -0,0 +1,170 @@
+/* usemem.h
+**
+** Common definitions for the usemem source files
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stddef.h>
+
+#define	HPAGESIZE	(2*1024*1024)	// PMD-mapped (transparent) huge page
+
+/*
+** phase boundaries, written to the ftrace trace_marker (when writable)
+** and defined as USDT probe usemem:name (when sys/sdt.h is installed),
+** e.g.  perf probe -x usemem sdt_usemem:alloc_start
+**       bpftrace -e 'usdt:./usemem:usemem:reference_end { ... }'
+** both arguments are numbers, mostly address and size
+*/
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define	HAVE_SDT
+#endif
+#endif
+
+#ifdef	HAVE_SDT
+#define	TRACEPOINT(name, a1, a2)					\
+	do {								\
+		STAP_PROBE2(usemem, name, a1, a2);			\
+		tracemark(#name, (long long)(a1), (long long)(a2));	\
+	} while (0)
+#else
+#define	TRACEPOINT(name, a1, a2)					\
+		tracemark(#name, (long long)(a1), (long long)(a2))
+#endif
+
+/*
+** configuration as specified on the command line,
+** passed to the measurement modes (flag -x)
+*/
+struct uconf {
+	char		alloctype;	// a=malloc, m=mmap, s=Posix, S=SysV,
+					// F=hugetlbfs file, H=huge page mix
+	char		tflag, nflag, hflag, lflag, Mflag,
+			Cflag, Pflag, Rflag, Wflag;
+	long		pagesize;
+	long		repeatinterval;	// -1 when no repetition
+	long long	virtual;	// virtsize
+	long long	physical;	// physsize
+	long long	keepalive;	// alivesize
+	char		*modeopts;	// raw string of flag -o (or NULL)
+	char		*hugetlbfs;	// path of flag -F (or NULL)
+};
+
+/*
+** measurement mode, selected with flag -x
+*/
+struct umode {
+	char	*name;
+	int	(*func)(struct uconf *);
+	char	*optkeys;		// comma-separated valid keys for -o
+	char	*descr;
+};
+
+/*
+** totals of /proc/self/smaps_rollup in KiB (-1 when not available)
+*/
+struct rollup {
+	long long	rss, anon, anonhuge, filepmd, swap, locked;
+};
+
+/*
+** pages of an area in bytes, extrapolated when sampled
+*/
+struct pagestat {
+	long long	present;
+};
+
+#define	STATPAGES	65536		// default budget of pages per call
+#define	STATNSEC	1000000		// aimed cost per call (ns)
+#define	STATWINDOW	64		// minimum pages inspected per call
+
+// usemem.c
+//
+void		conflict(char, char);
+long long	getnum(const char *);
+void		do_advise(char *, int, void *, size_t);
+
+char		*allocmem(struct uconf *, long long, char **);
+void		freemem(struct uconf *, char *, long long);
+void		preadvise(struct uconf *, char *, long long);
+void		postadvise(struct uconf *, char *, long long);
+
+char		*modeopt(struct uconf *, const char *);
+long long	modeoptnum(struct uconf *, const char *, long long);
+
+// util.c
+//
+unsigned long long	nanotime(void);
+void			tracemark(const char *, long long, long long);
+long long		procvalue(const char *, const char *);
+int			writefile(const char *, const char *, ...);
+int			readfile(const char *, char *, size_t);
+int			cgroupfile(char *, size_t, const char *);
+long long		cgroupvalue(const char *);
+int			cgcreate(const char *, const char *, char *, size_t);
+long long		residentbytes(void *, size_t);
+char			*mapaligned(size_t, size_t);
+
+int			cputopo(int, const char *);
+int			pincpu(int);
+
+void			latsort(unsigned long long *, long);
+unsigned long long	latpct(unsigned long long *, long, double);
+
+int			perfopen(int, long long);
+void			perfstart(int);
+long long		perfstop(int);
+
+// stats.c
+//
+int		rollup(struct rollup *);
+long		vmacount(void *, size_t);
+int		pagestat(void *, size_t, long, struct pagestat *);
+int		nodestat(void *, size_t, long, long long *, int);
+
+// hugetlbfs.c
+//
+char		*hugetlbfsalloc(struct uconf *, long long, char **);
+void		hugetlbfsstat(void);
+long long	hugetlbfssize(long long);
+
+// hugemix.c
+//
+char		*hugemixalloc(struct uconf *, long long, char **);
+void		hugemixstat(void);
+
+// leak.c
+//
+void		leakinit(void);
+void		leaksample(void);
+
+// measurement modes
+//
+int		stackmode(struct uconf *);	// stack.c
+int		damonmode(struct uconf *);	// damon.c
+int		thpsplitmode(struct uconf *);	// thpsplit.c
+int		thpbloatmode(struct uconf *);	// thpbloat.c
+int		cgdepthmode(struct uconf *);	// cgdepth.c
+int		memhighmode(struct uconf *);	// memhigh.c
+int		dirtymode(struct uconf *);	// dirty.c
+int		ringmode(struct uconf *);	// ring.c
+int		densitymode(struct uconf *);	// density.c
+int		pollutemode(struct uconf *);	// pollute.c
+int		swapinmode(struct uconf *);	// swapin.c
+int		pgallocmode(struct uconf *);	// pgalloc.c
+int		soakmode(struct uconf *);	// soak.c
+int		zeropagemode(struct uconf *);	// zeropage.c
+int		intensitymode(struct uconf *);	// intensity.c
+int		clientsmode(struct uconf *);	// clients.c
+int		kvmode(struct uconf *);		// kv.c
+int		savemode(struct uconf *);	// snapshot.c
+int		restoremode(struct uconf *);	// snapshot.c
+int		numabalmode(struct uconf *);	// numabal.c
+int		exectextmode(struct uconf *);	// exectext.c
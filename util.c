@@ -0,0 +1,407 @@
+/* util.c
+**
+** Helper functions shared by the usemem measurement modes
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#define	_GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "usemem.h"
+
+/*
+** current monotonic time in nanoseconds
+*/
+unsigned long long nanotime(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+** write a phase boundary to the ftrace buffer (via macro TRACEPOINT)
+** silently ignored when tracefs is not mounted or not writable
+*/
+void tracemark(const char *name, long long a1, long long a2)
+{
+	static int	fd = -2;
+	char		buf[128];
+	int		len;
+
+	if (fd == -2) {
+		if ( (fd = open("/sys/kernel/tracing/trace_marker",
+		                O_WRONLY|O_CLOEXEC)) == -1)
+			fd = open("/sys/kernel/debug/tracing/trace_marker",
+			          O_WRONLY|O_CLOEXEC);
+	}
+
+	if (fd == -1)
+		return;
+
+	len = snprintf(buf, sizeof buf, "usemem %s %#llx %lld\n",
+	               name, a1, a2);
+
+	(void) write(fd, buf, len);
+}
+
+/*
+** obtain the numeric value that follows the given key in a file
+** with lines as "key value", like /proc/meminfo, /proc/vmstat,
+** /proc/self/status or cgroup files as memory.stat and memory.events
+**
+** the key should include a trailing colon when the file uses it
+** (e.g. "MemAvailable:"); the value is returned in the unit of the
+** file itself (e.g. KiB for /proc/meminfo) or -1 when not found
+*/
+long long procvalue(const char *path, const char *key)
+{
+	FILE		*fp;
+	char		line[256];
+	size_t		keylen = strlen(key);
+	long long	value = -1;
+
+	if ( (fp = fopen(path, "r")) == NULL)
+		return -1;
+
+	while (fgets(line, sizeof line, fp)) {
+		if (strncmp(line, key, keylen) == 0 &&
+		    (line[keylen] == ' ' || line[keylen] == '\t')) {
+			value = strtoll(line+keylen, NULL, 10);
+			break;
+		}
+	}
+
+	fclose(fp);
+	return value;
+}
+
+/*
+** write a formatted string to a (sysfs, procfs or cgroup) file
+** returns -1 on failure with errno set
+*/
+int writefile(const char *path, const char *fmt, ...)
+{
+	FILE	*fp;
+	va_list	ap;
+	int	rv;
+
+	if ( (fp = fopen(path, "w")) == NULL)
+		return -1;
+
+	va_start(ap, fmt);
+	rv = vfprintf(fp, fmt, ap);
+	va_end(ap);
+
+	if (fclose(fp) == EOF || rv < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+** read the first line of a (sysfs, procfs or cgroup) file
+** without trailing newline
+** returns -1 on failure
+*/
+int readfile(const char *path, char *buf, size_t buflen)
+{
+	FILE	*fp;
+
+	if ( (fp = fopen(path, "r")) == NULL)
+		return -1;
+
+	if (!fgets(buf, buflen, fp)) {
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+
+	buf[strcspn(buf, "\n")] = 0;
+	return 0;
+}
+
+/*
+** build the pathname of a file in the cgroup (version 2) of this
+** process, e.g. "memory.current"
+** returns -1 when no cgroup version 2 hierarchy is mounted
+*/
+int cgroupfile(char *buf, size_t buflen, const char *name)
+{
+	static char	cgdir[PATH_MAX];
+	char		line[PATH_MAX], mnt[PATH_MAX/2], fstype[32];
+	FILE		*fp;
+
+	// determine mount point and own cgroup once
+	//
+	if (!cgdir[0]) {
+		if ( (fp = fopen("/proc/mounts", "r")) == NULL)
+			return -1;
+
+		mnt[0] = 0;
+
+		while (fgets(line, sizeof line, fp)) {
+			if (sscanf(line, "%*s %2047s %31s", mnt, fstype) == 2 &&
+			    strcmp(fstype, "cgroup2") == 0)
+				break;
+
+			mnt[0] = 0;
+		}
+
+		fclose(fp);
+
+		if (!mnt[0] || (fp = fopen("/proc/self/cgroup", "r")) == NULL)
+			return -1;
+
+		while (fgets(line, sizeof line, fp)) {
+			if (strncmp(line, "0::", 3) == 0) {
+				line[strcspn(line, "\n")] = 0;
+				snprintf(cgdir, sizeof cgdir, "%s%s", mnt,
+				         strcmp(line+3, "/") ? line+3 : "");
+				break;
+			}
+		}
+
+		fclose(fp);
+
+		if (!cgdir[0])
+			return -1;
+	}
+
+	snprintf(buf, buflen, "%s/%s", cgdir, name);
+	return 0;
+}
+
+/*
+** obtain the value of a single-value file in the own cgroup
+** (e.g. "memory.max") in bytes
+** returns -1 when not available and LLONG_MAX for "max"
+*/
+long long cgroupvalue(const char *name)
+{
+	char	path[PATH_MAX], buf[64];
+
+	if (cgroupfile(path, sizeof path, name) == -1 ||
+	    readfile(path, buf, sizeof buf) == -1)
+		return -1;
+
+	if (strcmp(buf, "max") == 0)
+		return LLONG_MAX;
+
+	return strtoll(buf, NULL, 10);
+}
+
+/*
+** create a cgroup with the given name below the parent cgroup
+** and enable the memory controller in the parent for it
+** returns -1 on failure (with message)
+*/
+int cgcreate(const char *parent, const char *name, char *path, size_t len)
+{
+	char	ctl[PATH_MAX];
+
+	snprintf(ctl, sizeof ctl, "%s/cgroup.subtree_control", parent);
+
+	if (writefile(ctl, "+memory") == -1) {
+		fprintf(stderr, "cannot enable memory controller in %s: %s\n",
+		                parent, strerror(errno));
+		return -1;
+	}
+
+	snprintf(path, len, "%s/%s", parent, name);
+
+	if (mkdir(path, 0755) == -1) {
+		perror(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+** determine the number of bytes of a memory area that are
+** currently resident in memory (swapped pages are not counted)
+**
+** the page vector is kept for the next call, so this function
+** should only be called by one thread at a time
+*/
+long long residentbytes(void *start, size_t length)
+{
+	static unsigned char	*vec;
+	static size_t		veclen;
+	long			pagesize = sysconf(_SC_PAGESIZE);
+	size_t			i, npages;
+	long long		resident = 0;
+
+	npages = (length + pagesize - 1) / pagesize;
+
+	if (npages > veclen) {	// reuse vector for next calls
+		free(vec);
+
+		if ( (vec = malloc(npages)) == NULL) {
+			veclen = 0;
+			return -1;
+		}
+
+		veclen = npages;
+	}
+
+	if (mincore(start, length, vec) == -1)
+		return -1;
+
+	for (i=0; i < npages; i++)
+		if (vec[i] & 1)
+			resident += pagesize;
+
+	return resident;
+}
+
+/*
+** map anonymous private memory with the start address aligned
+** on the given boundary (e.g. huge page size); the slack before
+** and after the area is released, so munmap(p, size) frees all
+** returns NULL on failure
+*/
+char *mapaligned(size_t size, size_t align)
+{
+	char	*r, *p;
+
+	r = mmap(NULL, size + align, PROT_READ|PROT_WRITE,
+	         MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+
+	if (r == MAP_FAILED)
+		return NULL;
+
+	p = (char *)(((unsigned long)r + align - 1) / align * align);
+
+	if (p > r)
+		(void) munmap(r, p - r);
+
+	if (r + size + align > p + size)
+		(void) munmap(p + size, r + size + align - (p + size));
+
+	return p;
+}
+
+/*
+** obtain a numeric topology attribute of a CPU, like "core_id"
+** or "physical_package_id" (-1 when not available)
+*/
+int cputopo(int cpu, const char *name)
+{
+	char	path[128], buf[32];
+
+	snprintf(path, sizeof path,
+	         "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+
+	if (readfile(path, buf, sizeof buf) == -1)
+		return -1;
+
+	return atoi(buf);
+}
+
+/*
+** bind the calling thread or process to one CPU
+** returns -1 on failure
+*/
+int pincpu(int cpu)
+{
+	cpu_set_t	set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return sched_setaffinity(0, sizeof set, &set);
+}
+
+/*
+** sort an array of latencies and obtain a percentile
+*/
+static int latcmp(const void *a, const void *b)
+{
+	unsigned long long	x = *(unsigned long long *)a,
+				y = *(unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+void latsort(unsigned long long *lat, long n)
+{
+	qsort(lat, n, sizeof *lat, latcmp);
+}
+
+unsigned long long latpct(unsigned long long *lat, long n, double pct)
+{
+	if (n <= 0)
+		return 0;
+
+	return lat[(long)((n - 1) * pct / 100 + 0.5)];
+}
+
+/*
+** open a hardware performance counter for this thread (disabled)
+** type and config as defined for perf_event_open(2)
+** returns -1 when not available
+*/
+int perfopen(int type, long long config)
+{
+	struct perf_event_attr	pe;
+
+	memset(&pe, 0, sizeof pe);
+	pe.type			= type;
+	pe.size			= sizeof pe;
+	pe.config		= config;
+	pe.disabled		= 1;
+	pe.exclude_hv		= 1;
+
+	return syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+/*
+** start and stop counting, and read the counter
+*/
+void perfstart(int fd)
+{
+	if (fd != -1) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+long long perfstop(int fd)
+{
+	long long	count;
+
+	if (fd == -1)
+		return -1;
+
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return -1;
+
+	return count;
+}
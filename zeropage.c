@@ -0,0 +1,149 @@
+/* zeropage.c
+**
+** Measurement mode 'zeropage': read faults on anonymous memory that map
+** the shared zero page (or huge zero page), and the cost of the later
+** write that replaces it by a private page (copy-on-write)
+**
+** Usage: usemem -x zeropage [-o options] virtsize [physsize]
+**
+**   A fresh anonymous area of virtsize is read (one load per page) over
+**   physsize (default virtsize) without writing, after which the same
+**   pages are written.  For comparison, another fresh area is written
+**   without reading first.  This is done with transparent huge pages
+**   disabled (MADV_NOHUGEPAGE) and enabled (MADV_HUGEPAGE) for the area.
+**   For every phase the time per page, the page faults, and the increase
+**   of the resident size and the page tables of the process are shown.
+**   Pages that map the zero page are not counted in the resident size,
+**   but need page tables (unless a huge zero page is mapped).
+**
+** Options (-o):
+**   thp=list	colon-separated THP settings (default off:on)
+** ==========================================================================
+** Copyright (C) AT Computing	2008
+** Extended:     AT Computing	2017/2023
+** ==========================================================================
+** This file is free software.  You can redistribute it and/or modify
+** it under the terms of the GNU General Public License (GPL); either
+** version 3, or (at your option) any later version.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "usemem.h"
+
+#ifndef	MADV_HUGEPAGE
+#define	MADV_HUGEPAGE	0	// ignore if not supported
+#endif
+
+#ifndef	MADV_NOHUGEPAGE
+#define	MADV_NOHUGEPAGE	0	// ignore if not supported
+#endif
+
+#define	ZEROPAGE	"/sys/kernel/mm/transparent_hugepage/use_zero_page"
+
+static void		touch(char *, long long, long, int, const char *);
+
+int
+zeropagemode(struct uconf *cf)
+{
+	char		*thps, *s, item[16], buf[16];
+	char		*rd, *wr;
+	long long	size, hzp0;
+	int		thp;
+
+	thps = strdup(modeopt(cf, "thp") ? modeopt(cf, "thp") : "off:on");
+	size = cf->physical ? cf->physical : cf->virtual;
+
+	if (cf->alloctype != 'a' || cf->hflag) {
+		fprintf(stderr, "zeropage mode maps its own anonymous areas "
+		                "(no -m, -s, -S, -F, -H or -h)\n");
+		return 1;
+	}
+
+	if (readfile(ZEROPAGE, buf, sizeof buf) == -1)
+		snprintf(buf, sizeof buf, "?");
+
+	printf("%lld KiB mapped, %lld KiB touched, huge zero page %s\n",
+	       cf->virtual/1024, size/1024, strcmp(buf, "1") ? "disabled" :
+	                                                        "enabled");
+	printf("%-4s %-17s %10s %10s %12s %12s\n", "THP", "phase", "ns/page",
+	       "faults", "RSS+ KiB", "PTE+ KiB");
+
+	for (s = thps; *s; s += strcspn(s, ":"), s += *s == ':') {
+		snprintf(item, sizeof item, "%.*s", (int)strcspn(s, ":"), s);
+
+		if (strcmp(item, "on") && strcmp(item, "off")) {
+			fprintf(stderr, "wrong thp setting: %s\n", item);
+			return 1;
+		}
+
+		thp = strcmp(item, "on") == 0;
+
+		if ( (rd = mapaligned(cf->virtual, HPAGESIZE)) == NULL ||
+		     (wr = mapaligned(cf->virtual, HPAGESIZE)) == NULL) {
+			perror("mmap");
+			return 1;
+		}
+
+		do_advise(thp ? "thp=on" : "thp=off",
+		          thp ? MADV_HUGEPAGE : MADV_NOHUGEPAGE, rd, cf->virtual);
+		do_advise(thp ? "thp=on" : "thp=off",
+		          thp ? MADV_HUGEPAGE : MADV_NOHUGEPAGE, wr, cf->virtual);
+
+		hzp0 = procvalue("/proc/vmstat", "thp_zero_page_alloc");
+
+		touch(rd, size, cf->pagesize, 0, thp ? "on   read" : "off  read");
+		touch(rd, size, cf->pagesize, 1, "     write (CoW)");
+		touch(wr, size, cf->pagesize, 1, "     write fresh");
+
+		if (thp && hzp0 >= 0)
+			printf("     huge zero page allocations: %lld\n",
+			       procvalue("/proc/vmstat", "thp_zero_page_alloc") - hzp0);
+
+		fflush(stdout);
+
+		(void) munmap(rd, cf->virtual);
+		(void) munmap(wr, cf->virtual);
+	}
+
+	return 0;
+}
+
+/*
+** load or store one byte per page and show the cost
+*/
+static void touch(char *p, long long size, long pagesize, int write,
+                  const char *label)
+{
+	volatile char		*q = p;
+	long long		off, rss0, pte0;
+	struct rusage		ru0, ru1;
+	unsigned long long	t;
+
+	rss0 = procvalue("/proc/self/status", "VmRSS:");
+	pte0 = procvalue("/proc/self/status", "VmPTE:");
+
+	getrusage(RUSAGE_SELF, &ru0);
+	t = nanotime();
+
+	for (off=0; off < size; off += pagesize) {
+		if (write)
+			q[off] = 'X';
+		else
+			(void) q[off];
+	}
+
+	t = nanotime() - t;
+	getrusage(RUSAGE_SELF, &ru1);
+
+	printf("%-22s %10.1f %10ld %12lld %12lld\n", label,
+	       (double)t / (size / pagesize),
+	       ru1.ru_minflt - ru0.ru_minflt + ru1.ru_majflt - ru0.ru_majflt,
+	       procvalue("/proc/self/status", "VmRSS:") - rss0,
+	       procvalue("/proc/self/status", "VmPTE:") - pte0);
+}